@@ -49,7 +49,6 @@ double core_mhz(int verbose) {
     }
     while (fgets(buf, MAXBUF, fp)) {
 	if (strstr(buf, "cpu MHz")) {
-	    double cpu_mhz = 0.0;
 	    sscanf(buf, "cpu MHz\t: %lf", &cpu_mhz);
 	    break;
 	}
@@ -141,3 +140,24 @@ double get_counter()
     return delta_secs * cpu_mhz * 1e6;
 }
 
+/*
+ * Cycle stamp: cycles since some fixed point, read from the monotonic
+ * clock, which unlike the thread clock needs no system call and so is
+ * cheap enough to time a single request
+ */
+unsigned long cycle_stamp()
+{
+    double nsecs;
+#ifdef USE_TOD
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    nsecs = 1e9 * now.tv_sec + 1e3 * now.tv_usec;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    nsecs = 1e9 * now.tv_sec + now.tv_nsec;
+#endif
+    if (cpu_mhz == 0.0)
+	mhz(0);
+    return (unsigned long) (nsecs * cpu_mhz * 1e-3);
+}
@@ -20,3 +20,6 @@ void start_counter();
 
 /* Get # cycles since counter started.  Returns 1e20 if detect timing anomaly */
 double get_counter();
+
+/* Get # cycles since some fixed point.  Cheap enough to time one call */
+unsigned long cycle_stamp();
@@ -29,7 +29,9 @@
 /*
  * This is the list of default tracefiles in TRACEDIR that the driver
  * will use for testing. Modify this if you want to add or delete
- * traces from the driver's test suite.
+ * traces from the driver's test suite. syn-huge.rep has weight 0; it
+ * takes a few milliseconds and is the only trace whose requests reach
+ * MMAP_THRESHOLD, so every run still checks mapped blocks.
  */
 
 #define DEFAULT_TRACEFILES  \
@@ -54,7 +56,8 @@
   "syn-array.rep", \
   "syn-mix.rep", \
   "syn-string.rep", \
-  "syn-struct.rep"
+  "syn-struct.rep", \
+  "syn-huge.rep"
 
 #define DEFAULT_GIANT_TRACEFILES \
   "syn-giantarray-short.rep", \
@@ -148,9 +151,24 @@
 #define SPARSE_PAGE_SIZE (1<<10)
 
 /*
- * Maximum target load for hash table
+ * Maximum load of the page table before it doubles
  */
-#define HASH_LOAD 10.0
+#define HASH_LOAD 0.5
+
+/*
+ * Initial page table size, as a power of 2
+ */
+#define PAGE_TABLE_BITS 12
+
+/*
+ * Number of pages mapped at a time for the page pool
+ */
+#define PAGE_CHUNK_PAGES 1024
+
+/*
+ * Number of recently used pages whose lookups are cached (a power of 2)
+ */
+#define PAGE_CACHE_SIZE 16
 
 /***************** Parameters for looking up reference throughput *********/
 /*
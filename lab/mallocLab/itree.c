@@ -0,0 +1,264 @@
+/*
+ * Interval B+-tree implementation
+ *
+ * Inner nodes route a key to the child with the largest separator not
+ * above it.  Separators are lower bounds rather than exact minimums, so
+ * removing an interval never has to update them.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "itree.h"
+
+/*
+ * A node only splits when full, so each level takes about
+ * (ITREE_FANOUT/2) times the insertions of the one below to appear
+ */
+#define MAX_HEIGHT 24
+
+static void *new_node(size_t size);
+static int leaf_search(ileaf_t *leaf, ikey_t key);
+static int inner_search(inode_t *inner, ikey_t key);
+static ileaf_t *descend(itree_t *tree, ikey_t key, inode_t **path, int *slots);
+static void free_subtree(void *node, int height);
+
+itree_t *itree_new() {
+    itree_t *tree = malloc(sizeof(itree_t));
+    if (!tree) {
+	fprintf(stderr, "ERROR.  Couldn't create interval tree\n");
+	exit(1);
+    }
+    tree->first = new_node(sizeof(ileaf_t));
+    tree->root = tree->first;
+    tree->height = 0;
+    tree->count = 0;
+    return tree;
+}
+
+void itree_free(itree_t *tree) {
+    free_subtree(tree->root, tree->height);
+    free(tree);
+}
+
+void itree_insert(itree_t *tree, ikey_t lo, ikey_t hi, long value) {
+    inode_t *path[MAX_HEIGHT];
+    int slots[MAX_HEIGHT];
+    ileaf_t *leaf = descend(tree, lo, path, slots);
+    int pos = leaf_search(leaf, lo);
+    int half = ITREE_FANOUT / 2;
+    void *right = NULL;
+    ikey_t sep = 0;
+    int level;
+
+    if (leaf->count == ITREE_FANOUT) {
+	/* Move the upper half to a new leaf after this one */
+	ileaf_t *split = new_node(sizeof(ileaf_t));
+	memcpy(split->items, &leaf->items[half], (ITREE_FANOUT - half) * sizeof(interval_t));
+	split->count = ITREE_FANOUT - half;
+	leaf->count = half;
+	split->prev = leaf;
+	split->next = leaf->next;
+	if (leaf->next)
+	    leaf->next->prev = split;
+	leaf->next = split;
+	sep = split->items[0].lo;
+	right = split;
+	if (pos > half) {
+	    leaf = split;
+	    pos -= half;
+	}
+    }
+    memmove(&leaf->items[pos + 1], &leaf->items[pos], (leaf->count - pos) * sizeof(interval_t));
+    leaf->items[pos].lo = lo;
+    leaf->items[pos].hi = hi;
+    leaf->items[pos].value = value;
+    leaf->count++;
+    tree->count++;
+
+    /* Add each new right sibling to its parent, splitting that if full */
+    for (level = tree->height - 1; right; level--) {
+	if (level < 0) {
+	    if (tree->height + 1 >= MAX_HEIGHT) {
+		fprintf(stderr, "ERROR.  Interval tree too deep\n");
+		exit(1);
+	    }
+	    inode_t *root = new_node(sizeof(inode_t));
+	    root->keys[0] = 0;
+	    root->children[0] = tree->root;
+	    root->keys[1] = sep;
+	    root->children[1] = right;
+	    root->count = 2;
+	    tree->root = root;
+	    tree->height++;
+	    break;
+	}
+	inode_t *inner = path[level];
+	int i = slots[level] + 1;
+	void *new_right = NULL;
+	ikey_t new_sep = 0;
+	if (inner->count == ITREE_FANOUT) {
+	    inode_t *split = new_node(sizeof(inode_t));
+	    memcpy(split->keys, &inner->keys[half], (ITREE_FANOUT - half) * sizeof(ikey_t));
+	    memcpy(split->children, &inner->children[half], (ITREE_FANOUT - half) * sizeof(void *));
+	    split->count = ITREE_FANOUT - half;
+	    inner->count = half;
+	    new_sep = split->keys[0];
+	    new_right = split;
+	    if (i > half) {
+		inner = split;
+		i -= half;
+	    }
+	}
+	memmove(&inner->keys[i + 1], &inner->keys[i], (inner->count - i) * sizeof(ikey_t));
+	memmove(&inner->children[i + 1], &inner->children[i], (inner->count - i) * sizeof(void *));
+	inner->keys[i] = sep;
+	inner->children[i] = right;
+	inner->count++;
+	right = new_right;
+	sep = new_sep;
+    }
+}
+
+interval_t *itree_overlap(itree_t *tree, ikey_t lo, ikey_t hi) {
+    /* Only the interval with the largest lo <= hi can overlap */
+    ileaf_t *leaf = descend(tree, hi, NULL, NULL);
+    int pos = leaf_search(leaf, hi);
+    interval_t *pred;
+    if (pos > 0)
+	pred = &leaf->items[pos - 1];
+    else if (leaf->prev)
+	/* Every leaf but a lone root holds at least one interval */
+	pred = &leaf->prev->items[leaf->prev->count - 1];
+    else
+	return NULL;
+    return pred->hi >= lo ? pred : NULL;
+}
+
+bool itree_remove(itree_t *tree, ikey_t lo) {
+    inode_t *path[MAX_HEIGHT];
+    int slots[MAX_HEIGHT];
+    ileaf_t *leaf = descend(tree, lo, path, slots);
+    int pos = leaf_search(leaf, lo) - 1;
+    int level;
+
+    if (pos < 0 || leaf->items[pos].lo != lo)
+	return false;
+    memmove(&leaf->items[pos], &leaf->items[pos + 1], (leaf->count - pos - 1) * sizeof(interval_t));
+    leaf->count--;
+    tree->count--;
+    if (leaf->count > 0 || tree->height == 0)
+	return true;
+
+    /* Free the empty leaf, and any parents it leaves empty */
+    if (leaf->prev)
+	leaf->prev->next = leaf->next;
+    else
+	tree->first = leaf->next;
+    if (leaf->next)
+	leaf->next->prev = leaf->prev;
+    free(leaf);
+    for (level = tree->height - 1; level >= 0; level--) {
+	inode_t *inner = path[level];
+	int i = slots[level];
+	memmove(&inner->keys[i], &inner->keys[i + 1], (inner->count - i - 1) * sizeof(ikey_t));
+	memmove(&inner->children[i], &inner->children[i + 1], (inner->count - i - 1) * sizeof(void *));
+	if (--inner->count > 0)
+	    break;
+	free(inner);
+    }
+    if (level < 0) {
+	/* The last interval is gone */
+	tree->first = new_node(sizeof(ileaf_t));
+	tree->root = tree->first;
+	tree->height = 0;
+    }
+    /* A root with a single child is not needed */
+    while (tree->height > 0 && ((inode_t *) tree->root)->count == 1) {
+	inode_t *root = tree->root;
+	tree->root = root->children[0];
+	tree->height--;
+	free(root);
+    }
+    return true;
+}
+
+interval_t *itree_first(itree_t *tree, icursor_t *cursor) {
+    cursor->leaf = tree->first;
+    cursor->slot = -1;
+    return itree_next(cursor);
+}
+
+interval_t *itree_next(icursor_t *cursor) {
+    if (++cursor->slot == cursor->leaf->count) {
+	cursor->leaf = cursor->leaf->next;
+	cursor->slot = 0;
+	if (!cursor->leaf)
+	    return NULL;
+    }
+    return &cursor->leaf->items[cursor->slot];
+}
+
+/*************** Private Functions *******************/
+
+static void *new_node(size_t size) {
+    void *node = calloc(1, size);
+    if (!node) {
+	fprintf(stderr, "ERROR.  Couldn't create interval tree node\n");
+	exit(1);
+    }
+    return node;
+}
+
+/* Number of intervals in leaf with lo <= key */
+static int leaf_search(ileaf_t *leaf, ikey_t key) {
+    int lo = 0, hi = leaf->count;
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (leaf->items[mid].lo <= key)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+/* Child of inner to look for key in: the last one whose separator is <= key */
+static int inner_search(inode_t *inner, ikey_t key) {
+    int lo = 1, hi = inner->count;
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (inner->keys[mid] <= key)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo - 1;
+}
+
+/* Find the leaf for key, recording the inner nodes and slots on the way */
+static ileaf_t *descend(itree_t *tree, ikey_t key, inode_t **path, int *slots) {
+    void *node = tree->root;
+    int level;
+    for (level = 0; level < tree->height; level++) {
+	inode_t *inner = (inode_t *) node;
+	int i = inner_search(inner, key);
+	if (path) {
+	    path[level] = inner;
+	    slots[level] = i;
+	}
+	node = inner->children[i];
+    }
+    return (ileaf_t *) node;
+}
+
+static void free_subtree(void *node, int height) {
+    int i;
+    if (height > 0) {
+	inode_t *inner = (inode_t *) node;
+	for (i = 0; i < inner->count; i++)
+	    free_subtree(inner->children[i], height - 1);
+    }
+    free(node);
+}
@@ -0,0 +1,62 @@
+/*
+ * Interval B+-tree: holds a set of disjoint intervals [lo, hi], keyed
+ * by lo.  The leaves keep their intervals in sorted arrays and are
+ * chained in order, so lookups touch a few cache lines per level and
+ * walking the whole set is a scan of arrays.
+ *
+ * Nodes are only freed when they empty out, so a node may be less
+ * than half full after removals.
+ */
+
+typedef unsigned long ikey_t;
+
+/* Number of intervals in a leaf, and of children of an inner node */
+#define ITREE_FANOUT 32
+
+typedef struct {
+    ikey_t lo, hi;
+    long value;  /* Carried along for the caller */
+} interval_t;
+
+typedef struct ileaf {
+    int count;
+    struct ileaf *prev, *next;
+    interval_t items[ITREE_FANOUT];
+} ileaf_t;
+
+typedef struct {
+    int count;
+    ikey_t keys[ITREE_FANOUT];  /* keys[i] <= every lo under children[i] */
+    void *children[ITREE_FANOUT];
+} inode_t;
+
+typedef struct {
+    void *root;      /* A leaf if height is 0 */
+    int height;
+    ileaf_t *first;  /* Leftmost leaf */
+    size_t count;    /* Number of intervals */
+} itree_t;
+
+/* Position of an interval, for walking the tree in order */
+typedef struct {
+    ileaf_t *leaf;
+    int slot;
+} icursor_t;
+
+itree_t *itree_new();
+
+/* Delete all nodes in tree */
+void itree_free(itree_t *tree);
+
+/* Add [lo, hi], which must not overlap any interval in the tree */
+void itree_insert(itree_t *tree, ikey_t lo, ikey_t hi, long value);
+
+/* Find an interval that overlaps [lo, hi], or return NULL */
+interval_t *itree_overlap(itree_t *tree, ikey_t lo, ikey_t hi);
+
+/* Remove the interval starting at lo; returns false if there is none */
+bool itree_remove(itree_t *tree, ikey_t lo);
+
+/* Visit the intervals in order of lo; NULL after the last */
+interval_t *itree_first(itree_t *tree, icursor_t *cursor);
+interval_t *itree_next(icursor_t *cursor);
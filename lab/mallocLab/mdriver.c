@@ -20,12 +20,20 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <math.h>
+#include <pthread.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fcyc.h"
+#include "clock.h"
 #include "config.h"
-#include "stree.h"
+#include "itree.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -58,41 +66,55 @@ typedef enum { WNONE, WALL, WUTIL, WPERF } weight_t;
  */
 
 /*
- * Records the extent of each block's payload.
- * Organized as doubly linked list
- */
-typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    long index;            /* same index as free; for debugging */
-    struct range_t *next;
-    struct range_t *prev;
-} range_t;
-
-/*
- * All information about set of ranges represented as doubly-linked
- * list of ranges, plus a splay tree keyed by lo addresses
+ * The extents of the allocated payloads, as intervals [lo, hi] of
+ * addresses whose values are the block indexes
  */
 typedef struct {
-    range_t *list;
-    tree_t *lo_tree;
+    itree_t *payloads;
 } range_set_t;
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    int count;                          /* number of ids a batch request covers */
 } traceop_t;
 
+/* Requests in each chunk of a streamed trace, and bytes read at a time */
+#define STREAM_OPS   (1<<16)
+#define STREAM_BYTES (1<<20)
+
+/*
+ * Reads the requests of a streamed trace (-m) a chunk at a time. While
+ * the driver replays ops[0], a reader thread fills ops[1] with the next
+ * chunk, so only two chunks of the trace are in memory at once.
+ */
+typedef struct stream_t {
+    FILE *file;            /* the trace file */
+    bool binary;           /* it is a binary trace */
+    long start;            /* file offset of the first request */
+    int decoded;           /* requests read so far */
+    traceop_t *ops[2];     /* chunk being replayed, chunk being read */
+    int len;               /* number of requests in ops[1] */
+    unsigned char *bytes;  /* binary requests read but not yet decoded... */
+    size_t pos, avail;     /* ... from bytes[pos] up to bytes[avail] */
+    pthread_t reader;      /* thread filling ops[1] */
+    bool reading;          /* the reader is running */
+} stream_t;
+
 /* Holds the information for one trace file */
 typedef struct {
     char filename[MAXLINE];
     size_t data_bytes;    /* Peak number of data bytes allocated during trace */
     int num_ids;          /* number of alloc/realloc ids */
     int num_ops;          /* number of distinct requests */
+    int num_reqs;         /* number of requests, counting each object of a batch */
     weight_t weight;      /* weight for this trace */
-    traceop_t *ops;       /* array of requests */
+    traceop_t *ops;       /* array of requests op_base up to op_end, */
+    int op_base;          /* which are all of them unless the trace */
+    int op_end;           /* is streamed */
+    stream_t *stream;     /* reads a streamed trace, or NULL */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
@@ -108,6 +130,28 @@ typedef struct {
     range_set_t *ranges;
 } speed_t;
 
+/* Most threads a -j run uses, and the size of their free rings */
+#define MAX_THREADS 64
+#define RING_SIZE   1024
+
+/*
+ * Holds the state of one thread of a -j run. Each thread replays the
+ * whole trace into its own block arrays. With -x a thread hands the
+ * blocks it frees to its peer through the peer's ring, which only that
+ * one thread writes, and frees the blocks handed to it.
+ */
+typedef struct thread_t {
+    trace_t trace;             /* shares ops, with blocks of its own */
+    bool libc;                 /* replay with libc malloc */
+    bool failed;               /* an allocation failed */
+    bool done;                 /* finished its ops, written atomically */
+    struct thread_t *peer;     /* thread that frees its blocks, or NULL */
+    struct thread_t *source;   /* thread whose blocks it frees, or NULL */
+    void *ring[RING_SIZE];     /* blocks handed over by source */
+    unsigned long head;        /* ring slots written, by source */
+    unsigned long tail;        /* ring slots freed */
+} thread_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -125,6 +169,14 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* What a -P worker process sends back about the trace it checked */
+typedef struct {
+    int trace;         /* index of the trace */
+    bool valid;        /* did mm_malloc process it correctly? */
+    double util;       /* space utilization, if valid */
+    int errors;        /* number of errors the worker found */
+} check_result_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
@@ -133,6 +185,23 @@ typedef struct {
     double tput;  /* average throughput expressed in Kops/s */
 } sum_stats_t;
 
+/*
+ * Log-linear histogram of request latencies in cycles, for -L. Below
+ * LAT_SUB each latency has a bucket of its own; above it each power of
+ * two is split into LAT_SUB buckets, so a bucket is within 1/LAT_SUB of
+ * the latencies it holds.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_TYPES    5            /* one histogram per request type */
+
+typedef struct {
+    unsigned long count;          /* number of requests */
+    unsigned long max;            /* slowest of them */
+    unsigned long buckets[LAT_BUCKETS];
+} latency_t;
+
 /********************
  * For debugging.  If debug-mode is on, then we have each block start
  * at a "random" place (a hash of the index), and copy random data
@@ -160,6 +229,12 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool print_stats = false;  /* Print the mm_stats counters of each trace */
+static bool latency_mode = false; /* Print request latencies of each trace */
+static int num_threads = 0;       /* Replay traces on up to this many threads */
+static bool cross_free = false;   /* Threads free each other's blocks */
+static bool stream_mode = false;  /* Stream the requests of each trace */
+static int num_workers = 0;       /* Check traces in this many processes */
 /* If set, use sparse memory emulation */
 static bool sparse_mode = SPARSE_MODE;
 static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
@@ -188,6 +263,9 @@ static char **global_tracefiles = NULL;
 
 static char autoresult[MAXLINE]; /* autoresult string */
 
+/* Latencies of each request type in the last -L run of a trace */
+static latency_t latency[LAT_TYPES];
+
 /* Summary statistics for libc and student's mm.c submissions */
 static sum_stats_t global_libc_sum_stats;
 static sum_stats_t global_mm_sum_stats;
@@ -216,6 +294,19 @@ static void randomize_block(trace_t *trace, int index);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static void parse_trace(trace_t *trace, FILE *tracefile);
+static void parse_header(trace_t *trace, FILE *tracefile);
+static bool parse_op(trace_t *trace, FILE *tracefile, traceop_t *op);
+static void check_op_ids(const trace_t *trace, const traceop_t *op);
+static void map_trace(trace_t *trace);
+static uint64_t get_header(trace_t *trace, const unsigned char *h,
+                           uint64_t file_size);
+static void decode_op(trace_t *trace, const unsigned char **p,
+                      const unsigned char *end, traceop_t *op);
+static void open_stream(trace_t *trace, FILE *tracefile, bool binary);
+static void *read_chunk(void *ptr);
+static traceop_t *next_chunk(trace_t *trace, int i);
+static void rewind_stream(trace_t *trace);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
@@ -228,9 +319,24 @@ static void eval_libc_speed(void *ptr);
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
 static void eval_mm_speed(void *ptr);
+static unsigned long eval_mm_latency(trace_t *trace);
+static void add_latency(latency_t *lat, unsigned long cycles);
+static unsigned long latency_percentile(const latency_t *lat, double p);
+
+/* Routines for measuring how mm and libc scale with threads */
+static void run_threads(int num_tracefiles, const char *tracedir,
+                        char **tracefiles);
+static int next_threads(int n);
+static double eval_threads(trace_t *trace, int n, bool libc);
+static void *replay_trace(void *ptr);
+static void thread_free(thread_t *t, void *p);
+static void drain_ring(thread_t *t);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static bool print_mm_stats(trace_t *trace);
+static bool frees_everything(trace_t *trace);
+static void print_latency(const char *filename, unsigned long overhead);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -240,17 +346,25 @@ static void app_error(const char *fmt, ...)
     __attribute__((format(printf, 1,2), noreturn));
 
 static sigjmp_buf timeout_jmpbuf;
+static volatile sig_atomic_t timed_out = 0;
 
 /* Timeout signal handler */
 static void timeout_handler(int sig __attribute__((unused))) {
     fprintf(stderr, "The driver timed out after %d secs\n", set_timeout);
     errors = 1;
+    timed_out = 1;
     longjmp(timeout_jmpbuf, 1);
 }
 
 /* Compute throughput from reference implementation */
 static double measure_ref_throughput(bool checkpoint);
 
+/* Check traces in worker processes, for -P */
+static void check_traces(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, stats_t *mm_stats);
+static void check_trace(int fd, int tracenum, const char *tracedir,
+                        char **tracefiles);
+
 /*
  * Run the tests; return the number of tests run (may be less than
  * num_tracefiles, if there's a timeout)
@@ -260,6 +374,15 @@ static void run_tests(int num_tracefiles, const char *tracedir,
                       stats_t *mm_stats, speed_t *speed_params) {
     volatile int i;
 
+    /*
+     * With -P, the correctness and utilization of the traces are
+     * checked in parallel first, leaving only the timing for the
+     * loop below, which still runs one trace at a time.
+     */
+    volatile bool checked = num_workers > 0 && !onetime_flag;
+    if (checked)
+        check_traces(num_tracefiles, tracedir, tracefiles, mm_stats);
+
     for (i=0; i < num_tracefiles; i++) {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
@@ -269,15 +392,20 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 
         // NOTE: If times out, then it will reread the trace file 
 
-        trace_t *trace;
+        trace_t * volatile trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].ops = trace->num_reqs;
 
-        /* Prepare for timeout */
-        if (setjmp(timeout_jmpbuf) != 0) {
+        /*
+         * Prepare for timeout. The jump may leave mm.c holding one of
+         * its locks, so no trace runs after it.
+         */
+        if (timed_out) {
             mm_stats[i].valid = false;
-        } else {
+        } else if (setjmp(timeout_jmpbuf) != 0) {
+            mm_stats[i].valid = false;
+        } else if (!checked) {
             if (verbose > 1)
                 printf("Checking mm_malloc for correctness, ");
             mm_stats[i].valid = eval_mm_valid(trace, ranges);
@@ -288,21 +416,23 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             }
         }
         if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            if (!checked) {
+                if (verbose > 1)
+                    printf("efficiency, ");
+                mm_stats[i].util = eval_mm_util(trace, i);
+            }
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
+            /* the counters cover the last run of the trace */
+            if (print_stats && !print_mm_stats(trace))
+                mm_stats[i].valid = false;
+            /* a run of its own, so the timing above is left alone */
+            if (latency_mode && !sparse_mode)
+                print_latency(trace->filename, eval_mm_latency(trace));
         }
-
-#if 0
-        printf(" %d operations.  %ld comparisons.  Avg = %.1f\n",
-               trace->num_ops, ranges->lo_tree->comparison_count,
-               (double) ranges->lo_tree->comparison_count / trace->num_ops);
-#endif
         free_trace(trace);
         free_range_set(ranges);
 
@@ -311,6 +441,122 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * check_traces - check the correctness and utilization of each trace in
+ *    a worker process of its own, with num_workers of them running at
+ *    once. Every worker starts from a fresh heap. A worker that dies
+ *    before sending back its result fails its trace.
+ */
+static void check_traces(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, stats_t *mm_stats)
+{
+    int fds[2], i, status;
+    pid_t pid, *pids;
+    bool *done;
+    check_result_t r;
+    sigset_t alarm_set;
+    volatile int next = 0, running = 0;
+
+    if (pipe(fds) < 0)
+        unix_error("pipe failed in check_traces");
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    pids = calloc(num_tracefiles, sizeof(pid_t));
+    done = calloc(num_tracefiles, sizeof(bool));
+    if (pids == NULL || done == NULL)
+        unix_error("calloc failed in check_traces");
+
+    /*
+     * The timeout fails every trace still being checked. It may only
+     * go off while waiting, since jumping out of fork or stdio would
+     * leave their locks held.
+     */
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+    setjmp(timeout_jmpbuf);
+
+    while (!timed_out && (next < num_tracefiles || running > 0)) {
+        if (next < num_tracefiles && running < num_workers) {
+            fflush(NULL);
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in check_traces");
+            if (pid == 0) {
+                close(fds[0]);
+                sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+                check_trace(fds[1], next, tracedir, tracefiles);
+                fflush(NULL);
+                _exit(0);
+            }
+            pids[next] = pid;
+            next++;
+            running++;
+            continue;
+        }
+        sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+        pid = wait(&status);
+        sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+        if (pid < 0)
+            unix_error("wait failed in check_traces");
+        running--;
+        /* A worker writes its result before it exits */
+        while (read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+            done[r.trace] = true;
+            mm_stats[r.trace].valid = r.valid;
+            mm_stats[r.trace].util = r.util;
+            errors += r.errors;
+        }
+        for (i = 0; i < num_tracefiles && pids[i] != pid; i++)
+            ;
+        if (i < num_tracefiles && !done[i]) {
+            errors++;
+            printf("ERROR [trace %s%s]: worker %s %d\n", tracedir, tracefiles[i],
+                   WIFSIGNALED(status) ? "killed by signal" : "exited with status",
+                   WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+            mm_stats[i].valid = false;
+        }
+    }
+
+    if (timed_out) {
+        for (i = 0; i < next; i++) {
+            if (!done[i]) {
+                kill(pids[i], SIGKILL);
+                waitpid(pids[i], NULL, 0);
+                mm_stats[i].valid = false;
+            }
+        }
+    }
+    sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    free(pids);
+    free(done);
+}
+
+/*
+ * check_trace - run in a worker process: check trace tracenum for
+ *    correctness and utilization, and send the result down fd.
+ */
+static void check_trace(int fd, int tracenum, const char *tracedir,
+                        char **tracefiles)
+{
+    check_result_t r;
+    stats_t stats;
+    trace_t *trace;
+    range_set_t *ranges;
+
+    /* Only count this trace's errors, not those the parent had so far */
+    errors = 0;
+    mem_init(sparse_mode);
+    ranges = new_range_set();
+    trace = read_trace(&stats, tracedir, tracefiles[tracenum]);
+    r.trace = tracenum;
+    r.valid = eval_mm_valid(trace, ranges);
+    r.util = r.valid ? eval_mm_util(trace, tracenum) : 0.0;
+    r.errors = errors;
+    if (write(fd, &r, sizeof(r)) != sizeof(r))
+        unix_error("write failed in check_trace");
+}
+
 /**************
  * Main routine
  **************/
@@ -351,7 +597,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:j:P:hpmOVAlDLSTx")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -408,6 +654,34 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'S':
+            print_stats = true;
+            break;
+
+        case 'L':
+            latency_mode = true;
+            break;
+
+        case 'j':
+            num_threads = atoi(optarg);
+            if (num_threads < 1 || num_threads > MAX_THREADS)
+                app_error("-j takes 1 to %d threads\n", MAX_THREADS);
+            break;
+
+        case 'x':
+            cross_free = true;
+            break;
+
+        case 'm':
+            stream_mode = true;
+            break;
+
+        case 'P':
+            num_workers = atoi(optarg);
+            if (num_workers < 1)
+                app_error("-P takes at least 1 worker\n");
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -531,6 +805,11 @@ int main(int argc, char **argv)
                (float)(global_mm_sum_stats.tput/global_libc_sum_stats.tput));
     }
 
+    /* Optionally measure how mm and libc scale with threads */
+    if (num_threads > 0 && errors == 0 && !sparse_mode && !onetime_flag &&
+        !stream_mode)
+        run_threads(num_global_tracefiles, tracedir, global_tracefiles);
+
     /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -691,8 +970,7 @@ static void add_tracefile(char *trace) {
  */
 static range_set_t *new_range_set() {
     range_set_t *ranges = (range_set_t *) malloc(sizeof(range_set_t));
-    ranges->list = NULL;
-    ranges->lo_tree = tree_new();
+    ranges->payloads = itree_new();
     return ranges;
 }
 
@@ -715,12 +993,14 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or the mapped area */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        ((lo < (char *)mem_map_lo()) || (hi > (char *)mem_map_hi()))) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
-                     lo, hi, mem_heap_lo(), mem_heap_hi());
+                     "Payload (%p:%p) lies outside heap (%p:%p) and mapped area (%p:%p)",
+                     lo, hi, mem_heap_lo(), mem_heap_hi(),
+                     mem_map_lo(), mem_map_hi());
         return false;
     }
 
@@ -728,61 +1008,25 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
        just assume the overlap will be caught by writing random bits. */
     if (debug_mode == DBG_NONE) return 1;
 
-    /* Look in the tree for the predecessor block */
-    range_t *prev = tree_find_nearest(ranges->lo_tree, (long unsigned) lo);
-    range_t *next = prev ? prev->next : NULL;
-    /* See if it overlaps previous or next blocks */
-    if (prev && lo <= prev->hi) {
+    /* See if it overlaps any other block */
+    interval_t *other = itree_overlap(ranges->payloads, (ikey_t) lo, (ikey_t) hi);
+    if (other) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                     lo, hi, prev->lo, prev->hi);
+                     lo, hi, (char *) other->lo, (char *) other->hi);
         return false;
     }
-    if (next && hi >= next->lo) {
-        malloc_error(trace, opnum,
-                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                     lo, hi, next->lo, next->hi);
-        return false;
-    }
-    /*
-     * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
-     */
-    range_t *p;
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->prev = prev;
-    if (prev)
-        prev->next = p;
-    else
-        ranges->list = p;
-    p->next = next;
-    if (next)
-        next->prev = p;
-    p->lo = lo;
-    p->hi = hi;
-    p->index = index;
-    tree_insert(ranges->lo_tree, (long unsigned) lo, (void *) p);
+    /* Everything looks OK, so remember the extent of this block */
+    itree_insert(ranges->payloads, (ikey_t) lo, (ikey_t) hi, index);
     return true;
 }
 
 /*
- * remove_range - Free the range record of block whose payload starts at lo
+ * remove_range - Forget the extent of the block whose payload starts at lo
  */
 static void remove_range(range_set_t *ranges, char *lo)
 {
-    range_t *p = (range_t *) tree_remove(ranges->lo_tree, (long unsigned) lo);
-    if (!p)
-        return;
-    range_t *prev = p->prev;
-    range_t *next = p->next;
-    if (prev)
-        prev->next = next;
-    else
-        ranges->list = next;
-    if (next)
-        next->prev = prev;
-    free(p);
+    itree_remove(ranges->payloads, (ikey_t) lo);
 }
 
 /*
@@ -790,7 +1034,7 @@ static void remove_range(range_set_t *ranges, char *lo)
  */
 static void free_range_set(range_set_t *ranges)
 {
-    tree_free(ranges->lo_tree, free);
+    itree_free(ranges->payloads);
     free(ranges);
 }
 
@@ -882,19 +1126,16 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory, or with -m
+ *    open it to be streamed
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index;
-    size_t size;
-    int max_index = 0;
-    int op_index;
-    int ignore = 0;
+    char magic[8];
+    bool binary;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -909,21 +1150,25 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
-    int iweight;
-    ignore += fscanf(tracefile, "%d", &iweight);
-    trace->weight = iweight;
-    ignore += fscanf(tracefile, "%d", &trace->num_ids);
-    ignore +=  fscanf(tracefile, "%d", &trace->num_ops);
-    ignore +=  fscanf(tracefile, "%zd", &trace->data_bytes);
 
-    if (trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    /* A binary trace is mapped, a .rep file is parsed */
+    binary = fread(magic, sizeof(magic), 1, tracefile) == 1 &&
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    trace->stream = NULL;
+    if (stream_mode) {
+        open_stream(trace, tracefile, binary);
+    } else if (binary) {
+        fclose(tracefile);
+        map_trace(trace);
+    } else {
+        rewind(tracefile);
+        parse_trace(trace, tracefile);
+        fclose(tracefile);
+    }
+    if (!stream_mode) {
+        trace->op_base = 0;
+        trace->op_end = trace->num_ops;
     }
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
@@ -940,48 +1185,397 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
         unix_error("malloc 5 failed in read_trace");
 
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_reqs;
+
+    return trace;
+}
+
+/*
+ * trace_op - return request i of trace, or NULL past the last one. The
+ *    requests of a streamed trace must be asked for in order.
+ */
+static inline traceop_t *trace_op(trace_t *trace, int i)
+{
+    if (i < trace->op_end)
+        return &trace->ops[i - trace->op_base];
+    return trace->stream != NULL ? next_chunk(trace, i) : NULL;
+}
+
+/*
+ * parse_header - fill in the header fields of trace from the .rep file
+ *    tracefile
+ */
+static void parse_header(trace_t *trace, FILE *tracefile)
+{
+    int ignore = 0;
+
+    int iweight;
+    ignore += fscanf(tracefile, "%d", &iweight);
+    trace->weight = iweight;
+    ignore += fscanf(tracefile, "%d", &trace->num_ids);
+    ignore +=  fscanf(tracefile, "%d", &trace->num_ops);
+    ignore +=  fscanf(tracefile, "%zd", &trace->data_bytes);
+
+    if (trace->weight < 0 || trace->weight > 3) {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    }
+}
+
+/*
+ * parse_op - read the next request line of the .rep file tracefile
+ *    into op; return false at the end of the file
+ */
+static bool parse_op(trace_t *trace, FILE *tracefile, traceop_t *op)
+{
+    char type[MAXLINE];
+    int index;
+    size_t size;
+    int count;
+    int ignore = 0;
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+        return false;
+    op->count = 1;
+    switch(type[0]) {
+    case 'a':
+        ignore += fscanf(tracefile, "%u %lu", &index, &size);
+        op->type = ALLOC;
+        op->index = index;
+        op->size = size;
+        break;
+    case 'r':
+        ignore += fscanf(tracefile, "%u %lu", &index, &size);
+        op->type = REALLOC;
+        op->index = index;
+        op->size = size;
+        break;
+    case 'f':
+        ignore += fscanf(tracefile, "%u", &index);
+        op->type = FREE;
+        op->index = index;
+        break;
+    case 'A':
+        ignore += fscanf(tracefile, "%u %u %lu", &index, &count, &size);
+        op->type = ALLOC_BATCH;
+        op->index = index;
+        op->count = count;
+        op->size = size;
+        break;
+    case 'F':
+        ignore += fscanf(tracefile, "%u %u", &index, &count);
+        op->type = FREE_BATCH;
+        op->index = index;
+        op->count = count;
+        break;
+    default:
+        app_error("Bogus type character (%c) in tracefile %s\n",
+                  type[0], trace->filename);
+    }
+    check_op_ids(trace, op);
+    return true;
+}
+
+/*
+ * check_op_ids - fail unless the block ids that op uses are all in
+ *    the range the header gives, since the blocks arrays are only that
+ *    long. Only a free may use id -1, which frees NULL.
+ */
+static void check_op_ids(const trace_t *trace, const traceop_t *op)
+{
+    if (op->index < (op->type == FREE ? -1 : 0) || op->count < 0 ||
+        op->index + op->count > trace->num_ids)
+        app_error("%s: block id %ld is out of range\n",
+                  trace->filename, op->index);
+}
+
+/*
+ * parse_trace - fill in the header and requests of trace from the .rep
+ *    file tracefile
+ */
+static void parse_trace(trace_t *trace, FILE *tracefile)
+{
+    traceop_t *op;
+    long max_index = 0;
+    int op_index;
+
+    parse_header(trace, tracefile);
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc 2 failed in read_trace");
 
     /* read every request line in the trace file */
-    index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            ignore += fscanf(tracefile, "%u %lu", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            ignore += fscanf(tracefile, "%u %lu", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            ignore += fscanf(tracefile, "%u", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            app_error("Bogus type character (%c) in tracefile %s\n",
-                      type[0], trace->filename);
-        }
+    trace->num_reqs = 0;
+    while (op_index < trace->num_ops &&
+           parse_op(trace, tracefile, op = &trace->ops[op_index])) {
+        if (op->type != FREE && op->type != FREE_BATCH &&
+            op->index + op->count - 1 > max_index)
+            max_index = op->index + op->count - 1;
+        trace->num_reqs += op->count;
         op_index++;
-        if (op_index == trace->num_ops) break;
     }
-    fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
 
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+/*
+ * get_header - fill in the header fields of trace from the header h of
+ *    a binary trace file of file_size bytes, and return the length of
+ *    its op array
+ */
+static uint64_t get_header(trace_t *trace, const unsigned char *h,
+                           uint64_t file_size)
+{
+    uint64_t num_ops, ops_bytes;
+
+    trace->weight = trace_get_le(h + 8, 4);
+    trace->num_ids = trace_get_le(h + 12, 4);
+    num_ops = trace_get_le(h + 16, 8);
+    trace->num_reqs = trace_get_le(h + 24, 8);
+    trace->data_bytes = trace_get_le(h + 32, 8);
+    ops_bytes = trace_get_le(h + 40, 8);
+    if (trace->weight < 0 || trace->weight > 3)
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    if (num_ops > INT_MAX || ops_bytes > file_size - TRACE_HEADER_SIZE)
+        app_error("%s: bad binary trace header\n", trace->filename);
+    trace->num_ops = num_ops;
+    return ops_bytes;
+}
 
-    return trace;
+/*
+ * decode_op - decode the binary request at *p, which may not pass end,
+ *    into op and move *p past it
+ */
+static void decode_op(trace_t *trace, const unsigned char **p,
+                      const unsigned char *end, traceop_t *op)
+{
+    uint64_t index, count = 1, size = 0;
+
+    if (*p == end)
+        app_error("%s: binary trace is cut off\n", trace->filename);
+    switch (*(*p)++) {
+    case 'a':
+        op->type = ALLOC;
+        break;
+    case 'r':
+        op->type = REALLOC;
+        break;
+    case 'f':
+        op->type = FREE;
+        break;
+    case 'A':
+        op->type = ALLOC_BATCH;
+        break;
+    case 'F':
+        op->type = FREE_BATCH;
+        break;
+    default:
+        app_error("Bogus type byte (%d) in tracefile %s\n",
+                  (*p)[-1], trace->filename);
+    }
+    if (!trace_get_varint(p, end, &index) ||
+        ((op->type == ALLOC_BATCH || op->type == FREE_BATCH) &&
+         !trace_get_varint(p, end, &count)) ||
+        (op->type != FREE && op->type != FREE_BATCH &&
+         !trace_get_varint(p, end, &size)))
+        app_error("%s: binary trace is cut off\n", trace->filename);
+    /* ids are stored plus one, so that -1 is 0 */
+    op->index = (long) index - 1;
+    op->count = count;
+    op->size = size;
+}
+
+/*
+ * map_trace - fill in the header and requests of trace from the binary
+ *    trace file trace->filename, which is mapped rather than read.
+ */
+static void map_trace(trace_t *trace)
+{
+    int fd, op_index;
+    struct stat st;
+    const unsigned char *map, *p, *end;
+    long max_index = -1;
+    traceop_t *op;
+
+    if ((fd = open(trace->filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        unix_error("Could not open %s in map_trace", trace->filename);
+    if (st.st_size < TRACE_HEADER_SIZE)
+        app_error("%s: binary trace is cut off\n", trace->filename);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        unix_error("mmap failed in map_trace");
+    close(fd);
+    madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+
+    p = map + TRACE_HEADER_SIZE;
+    end = p + get_header(trace, map, st.st_size);
+
+    if ((trace->ops =
+         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc 2 failed in map_trace");
+
+    /* decode every request, stopping at the end of the op array */
+    for (op_index = 0; op_index < trace->num_ops; op_index++) {
+        op = &trace->ops[op_index];
+        decode_op(trace, &p, end, op);
+        check_op_ids(trace, op);
+        if (op->type != FREE && op->type != FREE_BATCH &&
+            op->index + op->count - 1 > max_index)
+            max_index = op->index + op->count - 1;
+    }
+    munmap((void *) map, st.st_size);
+    if (max_index != trace->num_ids - 1)
+        app_error("%s: block ids do not match the header\n", trace->filename);
+}
+
+/*
+ * open_stream - read the header of tracefile, a binary trace if binary
+ *    is set, and get trace ready to read its requests a chunk at a
+ *    time. A .rep file is read through once here to count the requests
+ *    of its batches.
+ */
+static void open_stream(trace_t *trace, FILE *tracefile, bool binary)
+{
+    stream_t *s;
+    unsigned char header[TRACE_HEADER_SIZE];
+    struct stat st;
+    traceop_t op;
+    long max_index = -1;
+    int op_index;
+
+    if ((s = calloc(1, sizeof(stream_t))) == NULL)
+        unix_error("malloc failed in open_stream");
+    s->file = tracefile;
+    s->binary = binary;
+    rewind(tracefile);
+    if (binary) {
+        if (fstat(fileno(tracefile), &st) < 0)
+            unix_error("Could not stat %s in open_stream", trace->filename);
+        if (fread(header, sizeof(header), 1, tracefile) != 1)
+            app_error("%s: binary trace is cut off\n", trace->filename);
+        get_header(trace, header, st.st_size);
+        if ((s->bytes = malloc(STREAM_BYTES)) == NULL)
+            unix_error("malloc failed in open_stream");
+    } else {
+        parse_header(trace, tracefile);
+    }
+    s->start = ftell(tracefile);
+
+    if (!binary) {
+        trace->num_reqs = 0;
+        for (op_index = 0; op_index < trace->num_ops &&
+                 parse_op(trace, tracefile, &op); op_index++) {
+            if (op.type != FREE && op.type != FREE_BATCH &&
+                op.index + op.count - 1 > max_index)
+                max_index = op.index + op.count - 1;
+            trace->num_reqs += op.count;
+        }
+        if (op_index != trace->num_ops || max_index != trace->num_ids - 1)
+            app_error("%s: requests do not match the header\n", trace->filename);
+    }
+
+    if ((s->ops[0] = malloc(STREAM_OPS * sizeof(traceop_t))) == NULL ||
+        (s->ops[1] = malloc(STREAM_OPS * sizeof(traceop_t))) == NULL)
+        unix_error("malloc failed in open_stream");
+    trace->ops = s->ops[0];
+    trace->op_base = trace->op_end = 0;
+    trace->stream = s;
+}
+
+/*
+ * read_chunk - read the next chunk of requests of a streamed trace into
+ *    the spare buffer. The reader thread runs it while the chunk before
+ *    is replayed.
+ */
+static void *read_chunk(void *ptr)
+{
+    trace_t *trace = (trace_t *) ptr;
+    stream_t *s = trace->stream;
+    traceop_t *op;
+    const unsigned char *p;
+    int i, n = trace->num_ops - s->decoded;
+
+    if (n > STREAM_OPS)
+        n = STREAM_OPS;
+    for (i = 0; i < n; i++) {
+        op = &s->ops[1][i];
+        if (!s->binary) {
+            if (!parse_op(trace, s->file, op))
+                app_error("%s: trace is cut off\n", trace->filename);
+        } else {
+            /* keep a whole request in the buffer until the file ends */
+            if (s->avail - s->pos < TRACE_OP_MAX && !feof(s->file)) {
+                memmove(s->bytes, s->bytes + s->pos, s->avail - s->pos);
+                s->avail -= s->pos;
+                s->pos = 0;
+                s->avail += fread(s->bytes + s->avail, 1,
+                                  STREAM_BYTES - s->avail, s->file);
+            }
+            p = s->bytes + s->pos;
+            decode_op(trace, &p, s->bytes + s->avail, op);
+            s->pos = p - s->bytes;
+            check_op_ids(trace, op);
+        }
+    }
+    s->decoded += n;
+    s->len = n;
+    return NULL;
+}
+
+/*
+ * next_chunk - move a streamed trace on to its next chunk, which starts
+ *    with request i, and start reading the chunk after it. Return
+ *    request i, or NULL past the last.
+ */
+static traceop_t *next_chunk(trace_t *trace, int i)
+{
+    stream_t *s = trace->stream;
+    traceop_t *ops;
+
+    if (i >= trace->num_ops)
+        return NULL;
+    assert(i == trace->op_end);
+    if (s->reading) {
+        pthread_join(s->reader, NULL);
+        s->reading = false;
+    }
+    ops = s->ops[0];
+    s->ops[0] = s->ops[1];
+    s->ops[1] = ops;
+    trace->ops = s->ops[0];
+    trace->op_base = trace->op_end;
+    trace->op_end += s->len;
+    if (s->decoded < trace->num_ops) {
+        if (pthread_create(&s->reader, NULL, read_chunk, trace) != 0)
+            unix_error("pthread_create failed in next_chunk");
+        s->reading = true;
+    }
+    return &trace->ops[i - trace->op_base];
+}
+
+/*
+ * rewind_stream - start a streamed trace over from its first request
+ */
+static void rewind_stream(trace_t *trace)
+{
+    stream_t *s = trace->stream;
+
+    if (s->reading) {
+        pthread_join(s->reader, NULL);
+        s->reading = false;
+    }
+    if (fseek(s->file, s->start, SEEK_SET) != 0)
+        unix_error("fseek failed in rewind_stream");
+    s->decoded = 0;
+    s->pos = s->avail = 0;
+    trace->op_base = trace->op_end = 0;
+    read_chunk(trace);
+    next_chunk(trace, 0);
 }
 
 /*
@@ -992,6 +1586,8 @@ static void reinit_trace(trace_t *trace)
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
     memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
     /* block_rand_base is unused if size is zero */
+    if (trace->stream != NULL)
+        rewind_stream(trace);
 }
 
 /*
@@ -1000,6 +1596,16 @@ static void reinit_trace(trace_t *trace)
  */
 static void free_trace(trace_t *trace)
 {
+    stream_t *s = trace->stream;
+
+    if (s != NULL) {          /* a streamed trace owns its buffers */
+        if (s->reading)
+            pthread_join(s->reader, NULL);
+        fclose(s->file);
+        free(s->ops[1]);
+        free(s->bytes);
+        free(s);
+    }
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);
     free(trace->block_sizes);
@@ -1017,12 +1623,13 @@ static void free_trace(trace_t *trace)
  */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 {
-    int i;
-    int index;
+    int i, j;
+    int index, count;
     size_t size;
     char *newp;
     char *oldp;
     char *p;
+    traceop_t *op;
 
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
@@ -1035,12 +1642,13 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++) {
+        index = op->index;
+        size = op->size;
 
         if (debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
+            icursor_t cursor;
+            interval_t *r;
                         
             /* Let the students check their own heap */
             if (!mm_checkheap(0)) {
@@ -1049,14 +1657,12 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             };
 
             /* Now check that all our allocated blocks have the right data */
-            r = ranges->list;
-            while (r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            for (r = itree_first(ranges->payloads, &cursor); r;
+                 r = itree_next(&cursor))
+                check_index(trace, i, r->value);
         }
 
-        switch (trace->ops[i].type) {
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
 
@@ -1136,6 +1742,31 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             mm_free(p);
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            count = op->count;
+            if (mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return false;
+            }
+            for (j = index; j < index + count; j++) {
+                if (add_range(ranges, trace->blocks[j], size, trace, i, j) == 0)
+                    return false;
+                trace->block_sizes[j] = size;
+                randomize_block(trace, j);
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            count = op->count;
+            for (j = index; j < index + count; j++) {
+                check_index(trace, i, j);
+                remove_range(ranges, trace->blocks[j]);
+            }
+            /* The ids are dead, so mm_free_batch may reorder their slots */
+            mm_free_batch((void **) &trace->blocks[index], count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -1149,22 +1780,23 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   peak size in bytes of the heap plus the mapped regions while
+ *   running the student's malloc package on the trace. memlib tracks
+ *   it, since the brk pointer can be decremented and mapped regions
+ *   can be given back.
  *
  *   A higher number is better: 1 is optimal.
  */
 static double eval_mm_util(trace_t *trace, int tracenum)
 {
-    int i;
-    int index;
+    int i, j;
+    int index, count;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
     char *p;
     char *newp, *oldp;
+    traceop_t *op;
 
     reinit_trace(trace);
 
@@ -1173,12 +1805,12 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++) {
+        switch (op->type) {
 
         case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
 
             if ((p = mm_malloc(size)) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
@@ -1193,8 +1825,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op->index;
+            newsize = op->size;
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
@@ -1211,7 +1843,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             if (index < 0) {
                 size = 0;
                 p = 0;
@@ -1225,6 +1857,31 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             total_size -= size;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = op->index;
+            count = op->count;
+            size = op->size;
+
+            if (mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+            for (j = index; j < index + count; j++)
+                trace->block_sizes[j] = size;
+
+            total_size += count * size;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = op->index;
+            count = op->count;
+            for (j = index; j < index + count; j++)
+                total_size -= trace->block_sizes[j];
+
+            mm_free_batch((void **) &trace->blocks[index], count);
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1239,7 +1896,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     printf(".");
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_footprint());
 }
 
 
@@ -1249,9 +1906,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index;
+    int i, index, count;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
+    traceop_t *op;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
@@ -1261,20 +1919,20 @@ static void eval_mm_speed(void *ptr)
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++)
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
             if ((p = mm_malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op->index;
+            newsize = op->size;
             oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
@@ -1282,7 +1940,7 @@ static void eval_mm_speed(void *ptr)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             if (index < 0) {
                 block = 0;
             } else {
@@ -1291,11 +1949,104 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = op->index;
+            count = op->count;
+            size = op->size;
+            if (mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = op->index;
+            count = op->count;
+            mm_free_batch((void **) &trace->blocks[index], count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
 }
 
+/*
+ * eval_mm_latency - replays the trace once more, timing each request
+ *    on its own into the latency histograms. Returns the cost of
+ *    reading the counter, which is taken out of every latency.
+ */
+static unsigned long eval_mm_latency(trace_t *trace)
+{
+    int i;
+    unsigned long start, stop, overhead = ULONG_MAX;
+    char *p, *block;
+    traceop_t *op;
+
+    memset(latency, 0, sizeof(latency));
+    for (i = 0; i < 1000; i++) {
+        start = cycle_stamp();
+        stop = cycle_stamp();
+        if (stop - start < overhead)
+            overhead = stop - start;
+    }
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++) {
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            start = cycle_stamp();
+            p = mm_malloc(op->size);
+            stop = cycle_stamp();
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[op->index] = p;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            block = trace->blocks[op->index];
+            start = cycle_stamp();
+            p = mm_realloc(block, op->size);
+            stop = cycle_stamp();
+            if (p == NULL && op->size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[op->index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            block = op->index < 0 ? NULL : trace->blocks[op->index];
+            start = cycle_stamp();
+            mm_free(block);
+            stop = cycle_stamp();
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            start = cycle_stamp();
+            if (mm_malloc_batch(op->size, op->count,
+                                (void **) &trace->blocks[op->index])
+                != (size_t) op->count)
+                app_error("mm_malloc_batch error in eval_mm_latency");
+            stop = cycle_stamp();
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            start = cycle_stamp();
+            mm_free_batch((void **) &trace->blocks[op->index], op->count);
+            stop = cycle_stamp();
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+        stop -= start;
+        add_latency(&latency[op->type], stop > overhead ? stop - overhead : 0);
+    }
+    return overhead;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1304,41 +2055,57 @@ static void eval_mm_speed(void *ptr)
  */
 static bool eval_libc_valid(trace_t *trace)
 {
-    int i;
+    int i, j;
     size_t newsize;
     char *p, *newp, *oldp;
+    traceop_t *op;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++) {
+        switch (op->type) {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+            if ((p = malloc(op->size)) == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            trace->blocks[op->index] = p;
             break;
 
         case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
+            newsize = op->size;
+            oldp = trace->blocks[op->index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
                 malloc_error(trace, i, "libc realloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = newp;
+            trace->blocks[op->index] = newp;
             break;
 
         case FREE: /* free */
-            if (trace->ops[i].index >= 0) {
-                free(trace->blocks[trace->ops[i].index]);
+            if (op->index >= 0) {
+                free(trace->blocks[op->index]);
             } else {
                 free(0);
             }
             break;
 
+        case ALLOC_BATCH: /* one malloc per object */
+            for (j = 0; j < op->count; j++) {
+                if ((p = malloc(op->size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[op->index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* one free per object */
+            for (j = 0; j < op->count; j++)
+                free(trace->blocks[op->index + j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1354,27 +2121,28 @@ static bool eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
+    traceop_t *op;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++) {
+        switch (op->type) {
         case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
             if ((p = malloc(size)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
             break;
 
         case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op->index;
+            newsize = op->size;
             oldp = trace->blocks[index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
                 unix_error("realloc failed in eval_libc_speed\n");
@@ -1383,7 +2151,7 @@ static void eval_libc_speed(void *ptr)
             break;
 
         case FREE: /* free */
-            index = trace->ops[i].index;
+            index = op->index;
             if (index >= 0) {
                 block = trace->blocks[index];
                 free(block);
@@ -1391,8 +2159,246 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ALLOC_BATCH: /* one malloc per object */
+            index = op->index;
+            size = op->size;
+            for (j = 0; j < op->count; j++) {
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* one free per object */
+            index = op->index;
+            for (j = 0; j < op->count; j++)
+                free(trace->blocks[index + j]);
+            break;
+        }
+    }
+}
+
+/*
+ * run_threads - replay every trace on 1, 2, 4, ... and num_threads
+ *    threads at once, with mm and with libc, and print the throughput
+ *    of each count.
+ */
+static void run_threads(int num_tracefiles, const char *tracedir,
+                        char **tracefiles)
+{
+    int i, n;
+    stats_t stats;
+    trace_t *trace;
+    double mm_secs, libc_secs;
+    double mm_ops[MAX_THREADS + 1] = { 0 }, mm_sum[MAX_THREADS + 1] = { 0 };
+    double libc_ops[MAX_THREADS + 1] = { 0 }, libc_sum[MAX_THREADS + 1] = { 0 };
+
+    printf("Scaling with up to %d threads%s, Kops/sec:\n", num_threads,
+           cross_free ? " freeing each other's blocks" : "");
+    printf("  %7s %9s %9s %8s  %s\n", "threads", "mm", "libc", "mm/libc", "trace");
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init(sparse_mode);
+        trace = read_trace(&stats, tracedir, tracefiles[i]);
+        for (n = 1; n <= num_threads; n = next_threads(n)) {
+            mm_secs = eval_threads(trace, n, false);
+            libc_secs = eval_threads(trace, n, true);
+            /* the totals cover the traces mm got through */
+            if (mm_secs > 0) {
+                mm_ops[n] += (double) n * trace->num_reqs;
+                mm_sum[n] += mm_secs;
+                libc_ops[n] += (double) n * trace->num_reqs;
+                libc_sum[n] += libc_secs;
+            }
+            if (mm_secs > 0)
+                printf("  %7d %9.0f %9.0f %8.2f  %s\n", n,
+                       n * trace->num_reqs / mm_secs / 1e3,
+                       n * trace->num_reqs / libc_secs / 1e3,
+                       libc_secs / mm_secs, trace->filename);
+            else
+                printf("  %7d %9s %9.0f %8s  %s\n", n, "-",
+                       n * trace->num_reqs / libc_secs / 1e3, "-", trace->filename);
         }
+        free_trace(trace);
+        mem_deinit();
     }
+    for (n = 1; n <= num_threads; n = next_threads(n)) {
+        printf("  %7d %9.0f %9.0f %8.2f  Total\n", n,
+               mm_sum[n] > 0 ? mm_ops[n] / mm_sum[n] / 1e3 : 0.0,
+               libc_sum[n] > 0 ? libc_ops[n] / libc_sum[n] / 1e3 : 0.0,
+               mm_sum[n] > 0 ? (mm_ops[n] / mm_sum[n]) / (libc_ops[n] / libc_sum[n]) : 0.0);
+    }
+    printf("\n");
+}
+
+/* next_threads - the thread count after n: double it, up to num_threads */
+static int next_threads(int n)
+{
+    return n < num_threads && 2 * n > num_threads ? num_threads : 2 * n;
+}
+
+/*
+ * eval_threads - replay trace on n threads at once, three times, and
+ *    return the fastest time in seconds, or 0 if an allocation failed.
+ */
+static double eval_threads(trace_t *trace, int n, bool libc)
+{
+    thread_t *threads;
+    pthread_t tids[MAX_THREADS];
+    struct timespec start, end;
+    double secs, best = 0;
+    bool failed = false;
+    int i, run;
+
+    if ((threads = calloc(n, sizeof(thread_t))) == NULL)
+        unix_error("calloc failed in eval_threads");
+    for (i = 0; i < n; i++) {
+        threads[i].trace = *trace;
+        threads[i].trace.blocks = calloc(trace->num_ids, sizeof(char *));
+        threads[i].trace.block_sizes = calloc(trace->num_ids, sizeof(size_t));
+        if (threads[i].trace.blocks == NULL || threads[i].trace.block_sizes == NULL)
+            unix_error("calloc failed in eval_threads");
+        threads[i].libc = libc;
+    }
+    for (run = 0; run < 3 && !failed; run++) {
+        if (!libc) {
+            mem_reset_brk();
+            if (!mm_init())
+                app_error("mm_init failed in eval_threads");
+        }
+        for (i = 0; i < n; i++) {
+            reinit_trace(&threads[i].trace);
+            threads[i].failed = threads[i].done = false;
+            threads[i].head = threads[i].tail = 0;
+            /* thread i frees the blocks of thread i - 1 */
+            threads[i].peer = cross_free && n > 1 ? &threads[(i + 1) % n] : NULL;
+            threads[i].source = cross_free && n > 1 ? &threads[(i + n - 1) % n] : NULL;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < n; i++) {
+            if (pthread_create(&tids[i], NULL, replay_trace, &threads[i]) != 0)
+                unix_error("pthread_create failed in eval_threads");
+        }
+        for (i = 0; i < n; i++) {
+            pthread_join(tids[i], NULL);
+            failed |= threads[i].failed;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (run == 0 || secs < best)
+            best = secs;
+    }
+    for (i = 0; i < n; i++) {
+        free(threads[i].trace.blocks);
+        free(threads[i].trace.block_sizes);
+    }
+    free(threads);
+    return failed ? 0 : best;
+}
+
+/*
+ * replay_trace - run the trace of one thread of eval_threads. A failed
+ *    allocation stops the thread, but it still frees what its source
+ *    hands it, so that the source never waits.
+ */
+static void *replay_trace(void *ptr)
+{
+    thread_t *t = (thread_t *) ptr;
+    trace_t *trace = &t->trace;
+    int i, j, index, count;
+    size_t size;
+    char *p;
+
+    for (i = 0; i < trace->num_ops && !t->failed; i++) {
+        if (t->source != NULL)
+            drain_ring(t);
+        index = trace->ops[i].index;
+        count = trace->ops[i].count;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            p = t->libc ? malloc(size) : mm_malloc(size);
+            t->failed = p == NULL;
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC:
+            p = t->libc ? realloc(trace->blocks[index], size)
+                        : mm_realloc(trace->blocks[index], size);
+            t->failed = p == NULL && size != 0;
+            trace->blocks[index] = p;
+            break;
+
+        case FREE:
+            thread_free(t, index < 0 ? NULL : trace->blocks[index]);
+            break;
+
+        case ALLOC_BATCH:
+            if (t->libc) {
+                for (j = 0; j < count && !t->failed; j++)
+                    t->failed = (trace->blocks[index + j] = malloc(size)) == NULL;
+            } else {
+                t->failed = mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                            != (size_t) count;
+            }
+            break;
+
+        case FREE_BATCH:
+            /* a batch is freed where it was allocated */
+            if (t->libc) {
+                for (j = 0; j < count; j++)
+                    free(trace->blocks[index + j]);
+            } else {
+                mm_free_batch((void **) &trace->blocks[index], count);
+            }
+            break;
+        }
+    }
+    __atomic_store_n(&t->done, true, __ATOMIC_RELEASE);
+    if (t->source != NULL) {
+        while (!__atomic_load_n(&t->source->done, __ATOMIC_ACQUIRE))
+            drain_ring(t);
+        drain_ring(t);
+    }
+    return NULL;
+}
+
+/*
+ * thread_free - free p, or hand it to the peer of t if there is one
+ *    and its ring has room.
+ */
+static void thread_free(thread_t *t, void *p)
+{
+    thread_t *peer = t->peer;
+    unsigned long head;
+
+    if (p != NULL && peer != NULL) {
+        head = peer->head;
+        if (head - __atomic_load_n(&peer->tail, __ATOMIC_ACQUIRE) < RING_SIZE) {
+            peer->ring[head % RING_SIZE] = p;
+            __atomic_store_n(&peer->head, head + 1, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    if (t->libc)
+        free(p);
+    else
+        mm_free(p);
+}
+
+/* drain_ring - free every block the source of t has handed over */
+static void drain_ring(thread_t *t)
+{
+    unsigned long head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = t->tail;
+
+    for (; tail != head; tail++) {
+        if (t->libc)
+            free(t->ring[tail % RING_SIZE]);
+        else
+            mm_free(t->ring[tail % RING_SIZE]);
+    }
+    __atomic_store_n(&t->tail, tail, __ATOMIC_RELEASE);
 }
 
 /*************************************
@@ -1400,6 +2406,159 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * print_mm_stats - prints the mm_stats counters of the last run of a
+ *    trace: calls and free space per size class, then search, split,
+ *    merge and heap growth counts. Returns false if the trace frees
+ *    every block but some class counts more mallocs than frees, or
+ *    fewer.
+ */
+static bool print_mm_stats(trace_t *trace)
+{
+    mm_stats_t st;
+    int i;
+    bool ok = true;
+
+    printf("\nAllocator statistics for %s:\n", trace->filename);
+    if (!mm_stats(&st)) {
+        printf("  none, mm.c was built without MM_STATS\n");
+        return true;
+    }
+    printf("  %5s %10s %10s %8s %12s\n",
+           "class", "mallocs", "frees", "free", "free bytes");
+    for (i = 0; i < MM_STATS_CLASSES; i++) {
+        if (st.mallocs[i] == 0 && st.frees[i] == 0 && st.free_blocks[i] == 0)
+            continue;
+        printf("  %5d %10lu %10lu %8lu %12zu\n", i, st.mallocs[i],
+               st.frees[i], st.free_blocks[i], st.free_bytes[i]);
+    }
+    printf("  find_fit: %lu calls, %.1f probes per call, %lu at most\n",
+           st.fit_calls,
+           st.fit_calls ? (double) st.fit_probes / st.fit_calls : 0.0,
+           st.fit_probes_max);
+    printf("  splits: %lu, coalesces: %lu\n", st.splits, st.coalesces);
+    printf("  extend_heap: %lu calls, %lu bytes, heap %zu bytes\n",
+           st.extends, st.extend_bytes, st.heap_bytes);
+    if (!frees_everything(trace))
+        return true;
+    for (i = 0; i < MM_STATS_CLASSES; i++) {
+        if (st.mallocs[i] != st.frees[i]) {
+            printf("ERROR: class %d counts %lu mallocs but %lu frees\n",
+                   i, st.mallocs[i], st.frees[i]);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/*
+ * frees_everything - tells whether every block the trace allocates
+ *    is freed by its end
+ */
+static bool frees_everything(trace_t *trace)
+{
+    bool *live, all = true;
+    traceop_t *op;
+    int i, j;
+
+    if ((live = (bool *)calloc(trace->num_ids, sizeof(*live))) == NULL)
+        unix_error("calloc failed in frees_everything");
+    reinit_trace(trace);
+    for (i = 0;  (op = trace_op(trace, i)) != NULL;  i++) {
+        switch (op->type) {
+        case ALLOC:
+            live[op->index] = true;
+            break;
+        case REALLOC:
+            live[op->index] = op->size != 0;
+            break;
+        case FREE:
+            if (op->index >= 0)
+                live[op->index] = false;
+            break;
+        case ALLOC_BATCH:
+        case FREE_BATCH:
+            for (j = op->index; j < op->index + op->count; j++)
+                live[j] = op->type == ALLOC_BATCH;
+            break;
+        }
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        all = all && !live[i];
+    free(live);
+    return all;
+}
+
+/*
+ * add_latency - counts one request that took cycles in lat
+ */
+static void add_latency(latency_t *lat, unsigned long cycles)
+{
+    int shift;
+
+    lat->count++;
+    if (cycles > lat->max)
+        lat->max = cycles;
+    if (cycles < LAT_SUB) {
+        lat->buckets[cycles]++;
+        return;
+    }
+    /* the top LAT_SUB_BITS + 1 bits pick the bucket */
+    shift = 63 - __builtin_clzl(cycles) - LAT_SUB_BITS;
+    lat->buckets[(shift + 1) * LAT_SUB + ((cycles >> shift) & (LAT_SUB - 1))]++;
+}
+
+/*
+ * latency_percentile - the latency that a fraction p of the requests in
+ *    lat take at most, rounded up to the end of its bucket
+ */
+static unsigned long latency_percentile(const latency_t *lat, double p)
+{
+    unsigned long seen = 0, rank = (unsigned long) ceil(p * lat->count);
+    unsigned long high;
+    int b;
+
+    for (b = 0; b < LAT_BUCKETS - 1; b++) {
+        seen += lat->buckets[b];
+        if (seen >= rank)
+            break;
+    }
+    if (b == LAT_BUCKETS - 1)
+        return lat->max;
+    /* one less than the lowest latency of the next bucket */
+    b++;
+    if (b < LAT_SUB)
+        high = (unsigned long) b;
+    else
+        high = (unsigned long) (LAT_SUB + b % LAT_SUB) << (b / LAT_SUB - 1);
+    return high - 1 < lat->max ? high - 1 : lat->max;
+}
+
+/*
+ * print_latency - prints the percentiles of the latency histograms
+ *    filled in by eval_mm_latency
+ */
+static void print_latency(const char *filename, unsigned long overhead)
+{
+    static const char *names[LAT_TYPES] = {
+        "malloc", "free", "realloc", "malloc_batch", "free_batch"
+    };
+    int i;
+
+    printf("\nRequest latency in cycles for %s:\n", filename);
+    printf("  %-12s %10s %8s %8s %8s %10s\n",
+           "request", "count", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < LAT_TYPES; i++) {
+        if (latency[i].count == 0)
+            continue;
+        printf("  %-12s %10lu %8lu %8lu %8lu %10lu\n", names[i],
+               latency[i].count, latency_percentile(&latency[i], 0.5),
+               latency_percentile(&latency[i], 0.99),
+               latency_percentile(&latency[i], 0.999), latency[i].max);
+    }
+    printf("  %lu cycles of timer overhead taken out of each\n", overhead);
+}
+
 /*
  * printresults - prints a performance summary for some malloc package and returns
  *                a summary of the stats to the caller. 
@@ -1741,7 +2900,7 @@ static double measure_ref_throughput(bool checkpoint) {
     if (ltput > 0)
 	return ltput;
     char buf[MAXLINE];
-    char cmd[MAXLINE];
+    char cmd[2 * MAXLINE];   /* a command and the file name */
     char *fname = gen_file_name("./tput_%.8x.txt", buf, MAXLINE);
     float t;
     sprintf(cmd, "%s > %s", checkpoint ? REF_DRIVER_CHECKPOINT : REF_DRIVER,
@@ -1790,5 +2949,11 @@ static void usage(char *prog)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-S         Print allocator statistics for each trace\n");
+    fprintf(stderr, "\t-L         Print request latency percentiles for each trace\n");
+    fprintf(stderr, "\t-j <n>     Also time each trace on 1, 2, 4, ... <n> threads.\n");
+    fprintf(stderr, "\t-x         With -j, threads free each other's blocks.\n");
+    fprintf(stderr, "\t-m         Stream each trace in chunks rather than load it.\n");
+    fprintf(stderr, "\t-P <n>     Check traces in <n> worker processes, then time them.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
 }
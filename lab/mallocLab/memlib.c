@@ -3,8 +3,17 @@
  * because it allows us to interleave calls from the student's malloc
  * package with the system's malloc package in libc.
  *
- * This version has been updated to enable sparse emulation of very large heaps
+ * This version has been updated to enable sparse emulation of very large heaps.
+ * Pages of the sparse heap are handed out from chunks mapped as needed and
+ * found through a hash table that doubles as it fills, so the emulated
+ * heap may touch as much memory as the host can give it.
+ *
+ * Besides the brk heap, it hands out page-granular mapped regions. They
+ * are carved from the top of the heap's address range downwards, so the
+ * same sparse emulation covers them, and the brk heap may grow up to the
+ * lowest mapped page.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -22,76 +31,101 @@
 /* Data structure used to implement pages in sparse memory emulation */
 typedef struct MBLK {
     size_t id;                             /* Page ID.  Counts number of pages from start of heap */
-    struct MBLK *next;                     /* Link for hash table */
     unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
 } mem_block_t;
 
+/* A chunk of the pool that sparse pages are handed out from */
+typedef struct MCHUNK {
+    struct MCHUNK *next;                   /* Chunk mapped before this one */
+    size_t used;                           /* Number of pages handed out */
+    mem_block_t pages[PAGE_CHUNK_PAGES];
+} page_chunk_t;
+
+/* A cached lookup of the page table */
+typedef struct {
+    size_t id;                             /* Page ID, or NO_PAGE if the entry is empty */
+    struct MBLK *block;                    /* The page with that ID */
+} page_cache_t;
+
+#define NO_PAGE ((size_t) -1)
+
+/* A free range below the top of the mapped area, kept sorted by address */
+typedef struct MHOLE {
+    unsigned char *lo;                     /* First byte of the range */
+    size_t size;                           /* Length in bytes, a multiple of the page size */
+    struct MHOLE *next;
+} map_hole_t;
+
 /* private global variables */
 static bool sparse = false;                 /* Use sparse memory emulation */
 static unsigned char *heap;                 /* Starting address of heap */
-static unsigned char *mem_brk;              /* Current position of break */
+static unsigned char *mem_brk;              /* Current position of break, stored atomically */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
-static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
+static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap for the dense heap */
 static bool show_stats = false;             /* Should program print allocation information? */
 static bool stats_printed = false;          /* Has information been printed about allocation */
+static int dev_zero = -1;                   /* Backing file of the dense heap */
+
+/* Mapped regions */
+static unsigned char *map_lo;               /* Lowest mapped or once-mapped address */
+static map_hole_t *map_holes = NULL;        /* Free ranges above map_lo */
+static size_t map_bytes = 0;                /* Bytes currently mapped */
+static size_t peak_bytes = 0;               /* Peak of heap plus mapped bytes */
 
 /* Sparse memory representation */
-static mem_block_t *next_free_page = NULL;  /* Next free page */
-static size_t num_pages = 0;                /* Total number of pages */
-static size_t num_free_pages = 0;           /* Number of free pages */
-static mem_block_t **page_table = NULL;     /* Hash table from page ID to page */
-static size_t num_buckets = 0;              /* Number of buckets in page table */
+static page_chunk_t *chunks = NULL;         /* Page pool, newest chunk first */
+static size_t num_pages = 0;                /* Number of pages handed out */
+static mem_block_t **page_table = NULL;     /* Open-addressed hash table from page ID to page */
+static int table_bits = 0;                  /* The table has 2^table_bits slots */
+static page_cache_t page_cache[PAGE_CACHE_SIZE]; /* Direct-mapped by page ID */
 
 /*
  * Forward declarations
  */
 static size_t page_id(const void *addr);
 static void *page_start(size_t id);
+static mem_block_t *get_page(size_t id);
 static void *get_mem(const void *addr);
+static mem_block_t **table_slot(size_t id);
+static void grow_table(void);
+static mem_block_t *new_page(void);
+static void free_pages(void);
+static void clear_page_cache(void);
 static void print_stats();
+static size_t page_round(size_t size);
+static void add_hole(unsigned char *lo, size_t size);
+static void clear_holes(void);
+static void update_peak(void);
+static bool emulated(const void *addr, size_t len);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(bool do_sparse){
     sparse = do_sparse;
+    if (dev_zero < 0)
+	dev_zero = open("/dev/zero", O_RDWR);
     if (sparse) {
-	/* Want sparse total allocation to approximately match the dense heap size */
-	/* Account for both page itself and its amortized contribution to the page table */
-	double fbytes_per_page = sizeof(mem_block_t) + sizeof(mem_block_t *) / HASH_LOAD;
-	num_pages = (size_t) (MAX_DENSE_HEAP / fbytes_per_page);
-	num_buckets = num_pages / HASH_LOAD;
-	mmap_length =
-	    num_buckets * sizeof(mem_block_t *) +  // Page table
-	    num_pages * sizeof(mem_block_t) +      // Pages
-	    sizeof(uint64_t);                      // Padding
-    } else {
-	/* Dense allocation */
-	next_free_page = NULL;
-	num_pages = 0;
-	page_table = NULL;
-	num_buckets = 0;
-	mmap_length = MAX_DENSE_HEAP;
-    }
-
-    int dev_zero = open("/dev/zero", O_RDWR);
-    void *start = sparse ? NULL : TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,        /* suggested start*/
-		      mmap_length,  /* length */
-		      PROT_WRITE,   /* permissions */
-		      MAP_PRIVATE,  /* private or shared? */
-		      dev_zero,	    /* fd */
-		      0);	    /* offset */
-    if (addr == MAP_FAILED) {
-	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
-	exit(1);
-    }
-    if (sparse) {
-	/* Use initial space for page table */
-	page_table = (mem_block_t **) addr;
+	/* Pages and page table grow as the heap is touched */
+	table_bits = PAGE_TABLE_BITS;
+	page_table = (mem_block_t **) calloc((size_t) 1 << table_bits, sizeof(mem_block_t *));
+	if (page_table == NULL) {
+	    fprintf(stderr, "FAILURE.  Could not allocate page table\n");
+	    exit(1);
+	}
 	heap = SPARSE_HEAP_START;
 	mem_max_addr = heap + MAX_SPARSE_HEAP;
     } else {
+	void *addr = mmap(TRY_DENSE_HEAP_START, /* suggested start*/
+			  mmap_length,          /* length */
+			  PROT_WRITE,           /* permissions */
+			  MAP_PRIVATE,          /* private or shared? */
+			  dev_zero,             /* fd */
+			  0);                   /* offset */
+	if (addr == MAP_FAILED) {
+	    fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
+	    exit(1);
+	}
 	heap = addr;
 	mem_max_addr = heap + MAX_DENSE_HEAP;
     }
@@ -105,11 +139,15 @@ void mem_init(bool do_sparse){
  */
 void mem_deinit(void){
     print_stats();
-    munmap(heap, mmap_length);
-    next_free_page = NULL;
-    num_free_pages = 0;
-    page_table = NULL;
-    num_buckets = 0;
+    clear_holes();
+    if (sparse) {
+	free_pages();
+	free(page_table);
+	page_table = NULL;
+	table_bits = 0;
+    } else {
+	munmap(heap, mmap_length);
+    }
 }
 
 /*
@@ -118,29 +156,40 @@ void mem_deinit(void){
 void mem_reset_brk(){
     print_stats();
     if (sparse) {
-	/* Clear page table */
-	size_t ptb = num_buckets * sizeof(mem_block_t *);
-	memset((void *) page_table, 0, ptb);
-	/* First page is just beyond page table */
-	next_free_page = (mem_block_t *) ((unsigned char *) page_table + ptb);
-	num_free_pages = num_pages;
+	/* Give back every page; the table keeps its size */
+	free_pages();
+	memset((void *) page_table, 0, ((size_t) 1 << table_bits) * sizeof(mem_block_t *));
+	clear_page_cache();
     }
-    mem_brk = heap;
+    __atomic_store_n(&mem_brk, heap, __ATOMIC_RELAXED);
+    clear_holes();
+    map_lo = mem_max_addr;
+    map_bytes = 0;
+    peak_bytes = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap and returns the old break;
+ *		the dense heap releases the whole pages given back.
  */
 void *mem_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
 
     bool ok = true;
     if (incr < 0) {
-	ok = false;
-	fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+	if (mem_brk - heap < -incr) {
+	    ok = false;
+	    fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to shrink heap by %ld below its start\n", (long) -incr);
+	} else if (!sparse) {
+	    size_t page = mem_pagesize();
+	    uintptr_t lo = ((uintptr_t) (mem_brk + incr) + page - 1) / page * page;
+	    uintptr_t hi = (uintptr_t) mem_brk / page * page;
+	    if (lo < hi)
+		madvise((void *) lo, hi - lo, MADV_DONTNEED);
+	}
+    } else if (mem_brk + incr > map_lo) {
 	ok = false;
 	size_t alloc = mem_brk - heap + incr;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
@@ -149,7 +198,8 @@ void *mem_sbrk(intptr_t incr) {
 	fprintf(stderr, "ERROR: mem_sbrk failed.  Could not allocate more heap space\n");
     }
     if (ok) {
-	mem_brk += incr;
+	__atomic_store_n(&mem_brk, mem_brk + incr, __ATOMIC_RELAXED);
+	update_peak();
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -157,6 +207,129 @@ void *mem_sbrk(intptr_t incr) {
     }
 }
 
+/*
+ * mem_map - map a region of at least size bytes outside the brk heap,
+ *    rounded up to whole pages. Return NULL if there is no room.
+ */
+void *mem_map(size_t size) {
+    map_hole_t **link, *hole;
+    unsigned char *addr;
+
+    size = page_round(size);
+    /* First fit among the ranges given back so far */
+    for (link = &map_holes; (hole = *link) != NULL; link = &hole->next) {
+	if (hole->size >= size) {
+	    addr = hole->lo;
+	    hole->lo += size;
+	    hole->size -= size;
+	    if (hole->size == 0) {
+		*link = hole->next;
+		free(hole);
+	    }
+	    map_bytes += size;
+	    update_peak();
+	    return addr;
+	}
+    }
+    if ((size_t) (map_lo - mem_brk) < size) {
+	size_t alloc = mem_heapsize() + map_bytes + size;
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory.  Would require %zd (0x%zx) bytes\n", alloc, alloc);
+	return NULL;
+    }
+    map_lo -= size;
+    map_bytes += size;
+    update_peak();
+    return map_lo;
+}
+
+/*
+ * mem_unmap - give back the region of size bytes at addr. In the dense
+ *    heap its pages are released at once and read as zero when they are
+ *    mapped again; the sparse heap keeps its pages and their contents.
+ */
+void mem_unmap(void *addr, size_t size) {
+    size = page_round(size);
+    if (!sparse)
+	madvise(addr, size, MADV_DONTNEED);
+    map_bytes -= size;
+    add_hole((unsigned char *) addr, size);
+}
+
+/*
+ * mem_remap - resize the region of old_size bytes at addr to new_size
+ *    bytes, in place if the pages after it are free. Otherwise the pages
+ *    move to a new region: the dense heap remaps them, the sparse heap
+ *    copies them. Return the region, or NULL if it could not grow.
+ */
+void *mem_remap(void *addr, size_t old_size, size_t new_size) {
+    unsigned char *end, *new_addr;
+    map_hole_t **link, *hole;
+
+    old_size = page_round(old_size);
+    new_size = page_round(new_size);
+    end = (unsigned char *) addr + old_size;
+    if (new_size <= old_size) {
+	if (new_size < old_size)
+	    mem_unmap(end - (old_size - new_size), old_size - new_size);
+	return addr;
+    }
+    /* Grow into the free range right after the region */
+    for (link = &map_holes; (hole = *link) != NULL && hole->lo < end; link = &hole->next)
+	;
+    if (hole != NULL && hole->lo == end && hole->size >= new_size - old_size) {
+	hole->lo += new_size - old_size;
+	hole->size -= new_size - old_size;
+	if (hole->size == 0) {
+	    *link = hole->next;
+	    free(hole);
+	}
+	map_bytes += new_size - old_size;
+	update_peak();
+	return addr;
+    }
+    if ((new_addr = mem_map(new_size)) == NULL)
+	return NULL;
+    if (sparse) {
+	mem_memcpy(new_addr, addr, old_size);
+    } else if (mremap(addr, old_size, old_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+		      new_addr) != MAP_FAILED) {
+	/* The pages moved, put fresh ones back where they were */
+	if (mmap(addr, old_size, PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+		 dev_zero, 0) == MAP_FAILED) {
+	    fprintf(stderr, "FAILURE.  mmap couldn't refill moved region\n");
+	    exit(1);
+	}
+    } else {
+	/* Earlier moves can leave the region split across mappings */
+	memcpy(new_addr, addr, old_size);
+	madvise(addr, old_size, MADV_DONTNEED);
+    }
+    map_bytes -= old_size;
+    add_hole((unsigned char *) addr, old_size);
+    return new_addr;
+}
+
+/*
+ * mem_map_lo - return address of the lowest byte that may be mapped
+ */
+void *mem_map_lo(){
+    return (void *) map_lo;
+}
+
+/*
+ * mem_map_hi - return address of the last byte that may be mapped
+ */
+void *mem_map_hi(){
+    return (void *) (mem_max_addr - 1);
+}
+
+/*
+ * mem_footprint - returns the peak of heap plus mapped bytes
+ */
+size_t mem_footprint() {
+    return peak_bytes;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -165,10 +338,11 @@ void *mem_heap_lo(){
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte. The break is read
+ *    atomically, so a caller may ask while another thread moves it.
  */
 void *mem_heap_hi(){
-    return (void *)(mem_brk - 1);
+    return (void *)(__atomic_load_n(&mem_brk, __ATOMIC_RELAXED) - 1);
 }
 
 /*
@@ -204,8 +378,7 @@ void mem_write128(void* addr, __int128 val)
 /* Read len bytes and return value zero-extended to 64 bits */
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
-    if (sparse &&
-	(unsigned char *) addr >= heap && (unsigned char *) addr+len <= mem_brk) {
+    if (emulated(addr, len)) {
 	/* Heap read.  Check if it crosses page boundary */
 	size_t id = page_id(addr);
 	void *paddr = get_mem(addr);
@@ -237,8 +410,7 @@ uint64_t mem_read(const void *addr, size_t len) {
 
 /* Write lower order len bytes of val to address */
 void mem_write(void *addr, uint64_t val, size_t len) {
-    if (sparse &&
-	(unsigned char *) addr >= heap && (unsigned char *) addr+len <= mem_brk) {
+    if (emulated(addr, len)) {
 	/* Heap write.  Check to see if it crosses page boundary */
 	size_t id = page_id(addr);
 	void *paddr = get_mem(addr);
@@ -269,43 +441,46 @@ void mem_write(void *addr, uint64_t val, size_t len) {
     }
 }
 
-/* Emulation of memcpy */
+/*
+ * Emulation of memcpy.  Sparse memory is copied a page at a time: each
+ * piece ends at the next page boundary of either source or destination.
+ */
 void *mem_memcpy(void *dst, const void *src, size_t n) {
-    void *savedst = dst;
-    size_t w = sizeof(uint64_t);
-    while (n >= w) {
-	uint64_t data = mem_read(src, w);
-	mem_write(dst, data, w);
-	n -= w;
-	src = (void *) ((unsigned char *) src + w);
-	dst = (void *) ((unsigned char *) dst + w);
-    }
-    if (n) {
-	uint64_t data = mem_read(src, n);
-	mem_write(dst, data, n);
+    unsigned char *d = (unsigned char *) dst;
+    const unsigned char *s = (const unsigned char *) src;
+    if (!sparse)
+	return memcpy(dst, src, n);
+    while (n > 0) {
+	size_t len = n;
+	size_t sleft = SPARSE_PAGE_SIZE - (s - (unsigned char *) page_start(page_id(s)));
+	size_t dleft = SPARSE_PAGE_SIZE - (d - (unsigned char *) page_start(page_id(d)));
+	if (len > sleft)
+	    len = sleft;
+	if (len > dleft)
+	    len = dleft;
+	memcpy(emulated(d, len) ? get_mem(d) : (void *) d,
+	       emulated(s, len) ? get_mem(s) : (const void *) s, len);
+	n -= len;
+	s += len;
+	d += len;
     }
-    return savedst;
+    return dst;
 }
 
-/* Emulation of memset */
+/* Emulation of memset.  Sparse memory is set a page at a time */
 void *mem_memset(void *dst, int c, size_t n) {
-    void *savedst = dst;
-    uint64_t byte = c & 0xFF;
-    uint64_t data = 0;
-    size_t w = sizeof(uint64_t);
-    size_t i;
-    for (i = 0; i < w; i++) {
-	data = data | (byte << (8*i));
-    }
-    while (n >= w) {
-	mem_write(dst, data, w);
-	n -= w;
-	dst = (void *) ((unsigned char *) dst + w);
+    unsigned char *d = (unsigned char *) dst;
+    if (!sparse)
+	return memset(dst, c, n);
+    while (n > 0) {
+	size_t len = SPARSE_PAGE_SIZE - (d - (unsigned char *) page_start(page_id(d)));
+	if (len > n)
+	    len = n;
+	memset(emulated(d, len) ? get_mem(d) : (void *) d, c, len);
+	n -= len;
+	d += len;
     }
-    if (n) {
-	mem_write(dst, data, n);	
-    }
-    return savedst;
+    return dst;
 }
 
 /* Function to aid in viewing contents of heap */
@@ -339,10 +514,9 @@ static void print_stats() {
     if (!show_stats || vbytes == 0 || stats_printed)
 	return;
     if (sparse) {
-	size_t ppages = num_pages - num_free_pages;
-	size_t pbytes = ppages * SPARSE_PAGE_SIZE;
-	printf("Allocated %zu/%zu pages (%zu bytes) to cover %zu heap bytes (%.4f%% density).  Max address = %p\n",
-	       ppages, num_pages, pbytes, vbytes, 100.0 * pbytes / vbytes, mem_brk);
+	size_t pbytes = num_pages * SPARSE_PAGE_SIZE;
+	printf("Allocated %zu pages (%zu bytes) to cover %zu heap bytes (%.4f%% density).  Max address = %p\n",
+	       num_pages, pbytes, vbytes, 100.0 * pbytes / vbytes, mem_brk);
     } else {
 	printf("Allocated %zu heap bytes.  Max address = %p\n",
 	       vbytes, mem_brk);
@@ -350,6 +524,67 @@ static void print_stats() {
     stats_printed = true;
 }
 
+/* Round size up to a whole number of pages */
+static size_t page_round(size_t size) {
+    size_t page = mem_pagesize();
+    return (size + page - 1) / page * page;
+}
+
+/* Add a free range above map_lo, merging it with its neighbors */
+static void add_hole(unsigned char *lo, size_t size) {
+    map_hole_t **link, *hole, *prev = NULL;
+
+    for (link = &map_holes; (hole = *link) != NULL && hole->lo < lo; link = &hole->next)
+	prev = hole;
+    if (prev != NULL && prev->lo + prev->size == lo) {
+	prev->size += size;
+    } else {
+	if ((prev = malloc(sizeof(map_hole_t))) == NULL) {
+	    fprintf(stderr, "FAILURE.  Could not allocate mapped range record\n");
+	    exit(1);
+	}
+	prev->lo = lo;
+	prev->size = size;
+	prev->next = hole;
+	*link = prev;
+    }
+    if (hole != NULL && prev->lo + prev->size == hole->lo) {
+	prev->size += hole->size;
+	prev->next = hole->next;
+	free(hole);
+    }
+    /* The lowest range goes back to the space the heap can grow into */
+    if (map_holes->lo == map_lo) {
+	hole = map_holes;
+	map_lo += hole->size;
+	map_holes = hole->next;
+	free(hole);
+    }
+}
+
+static void clear_holes(void) {
+    map_hole_t *hole;
+
+    while ((hole = map_holes) != NULL) {
+	map_holes = hole->next;
+	free(hole);
+    }
+}
+
+static void update_peak(void) {
+    size_t bytes = mem_heapsize() + map_bytes;
+    if (bytes > peak_bytes)
+	peak_bytes = bytes;
+}
+
+/* Is [addr, addr+len) in sparse memory, either heap or mapped? */
+static bool emulated(const void *addr, size_t len) {
+    const unsigned char *lo = (const unsigned char *) addr;
+    return sparse &&
+	((lo >= heap && lo + len <= mem_brk) ||
+	 (lo >= map_lo && lo + len <= mem_max_addr));
+}
+
 /* Given an address, compute the ID  of its page */
 static size_t page_id(const void *addr) {
     size_t offset = (unsigned char *) addr - (unsigned char *) SPARSE_HEAP_START;
@@ -362,27 +597,99 @@ static void *page_start(size_t id) {
     return (void *) ((unsigned char *) SPARSE_HEAP_START + offset);
 }
 
-/* Get memory to store value.  Allocate page if necessary */
-static void *get_mem(const void *addr) {
-    size_t id = page_id(addr);
-    size_t b = id % num_buckets; // A very simple hash function
-    mem_block_t *block = page_table[b];
-    while (block && block->id != id)
-	block = block->next;
+/*
+ * Find the page with a given ID, allocating it if necessary.  Recent
+ * lookups are cached, since most accesses hit the page of the last few.
+ */
+static mem_block_t *get_page(size_t id) {
+    page_cache_t *entry = &page_cache[id & (PAGE_CACHE_SIZE - 1)];
+    if (entry->id == id)
+	return entry->block;
+    mem_block_t **slot = table_slot(id);
+    mem_block_t *block = *slot;
     if (!block) {
-	/* Need to allocate a new block */
-	if (num_free_pages == 0) {
-	    fprintf(stderr, "FAILURE.  Ran out of memory\n");
-	    exit(1);
+	/* Need to allocate a new block, first making room for it */
+	if (num_pages + 1 > HASH_LOAD * ((size_t) 1 << table_bits)) {
+	    grow_table();
+	    slot = table_slot(id);
 	}
-	block = next_free_page++;
-	num_free_pages--;
+	block = new_page();
 	block->id = id;
-	block->next = page_table[b];
-	page_table[b] = block;
+	*slot = block;
     }
+    entry->id = id;
+    entry->block = block;
+    return block;
+}
+
+/* Get memory to store value.  Allocate page if necessary */
+static void *get_mem(const void *addr) {
+    size_t id = page_id(addr);
     void *saddr = page_start(id);
     size_t offset = (unsigned char *) addr - (unsigned char *) saddr;
-    return (void *) &block->bytes[offset];
+    return (void *) &get_page(id)->bytes[offset];
 }
 
+/*
+ * Find the slot of the page table holding the page with a given ID, or
+ * the empty slot where it belongs.  Probing is linear from a
+ * multiplicative hash, whose top bits spread out consecutive IDs.
+ */
+static mem_block_t **table_slot(size_t id) {
+    size_t mask = ((size_t) 1 << table_bits) - 1;
+    size_t i = (size_t) ((uint64_t) id * 0x9E3779B97F4A7C15ULL >> (64 - table_bits));
+    while (page_table[i] && page_table[i]->id != id)
+	i = (i + 1) & mask;
+    return &page_table[i];
+}
+
+/* Double the page table and rehash its pages */
+static void grow_table(void) {
+    mem_block_t **old_table = page_table;
+    size_t old_size = (size_t) 1 << table_bits;
+    size_t i;
+    page_table = (mem_block_t **) calloc(old_size * 2, sizeof(mem_block_t *));
+    if (page_table == NULL) {
+	fprintf(stderr, "FAILURE.  Could not grow page table to %zu slots\n", old_size * 2);
+	exit(1);
+    }
+    table_bits++;
+    for (i = 0; i < old_size; i++)
+	if (old_table[i])
+	    *table_slot(old_table[i]->id) = old_table[i];
+    free(old_table);
+}
+
+/* Hand out a page, mapping a new chunk of the pool if necessary */
+static mem_block_t *new_page(void) {
+    page_chunk_t *chunk = chunks;
+    if (!chunk || chunk->used == PAGE_CHUNK_PAGES) {
+	chunk = mmap(NULL, sizeof(page_chunk_t), PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk == MAP_FAILED) {
+	    fprintf(stderr, "FAILURE.  Ran out of memory after %zu pages\n", num_pages);
+	    exit(1);
+	}
+	chunk->next = chunks;
+	chunks = chunk;
+    }
+    num_pages++;
+    return &chunk->pages[chunk->used++];
+}
+
+/* Unmap the whole page pool */
+static void free_pages(void) {
+    page_chunk_t *chunk;
+    while ((chunk = chunks) != NULL) {
+	chunks = chunk->next;
+	munmap(chunk, sizeof(page_chunk_t));
+    }
+    num_pages = 0;
+}
+
+/* Forget the cached lookups, when the page table is cleared */
+static void clear_page_cache(void) {
+    size_t i;
+    for (i = 0; i < PAGE_CACHE_SIZE; i++)
+	page_cache[i].id = NO_PAGE;
+}
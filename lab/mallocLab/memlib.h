@@ -11,6 +11,14 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Page-granular regions outside the brk heap */
+void *mem_map(size_t size);
+void mem_unmap(void *addr, size_t size);
+void *mem_remap(void *addr, size_t old_size, size_t new_size);
+void *mem_map_lo(void);
+void *mem_map_hi(void);
+size_t mem_footprint(void);
+
 /* Functions used for memory emulation */
 
 /* Read len bytes and return value zero-extended to 64 bits */
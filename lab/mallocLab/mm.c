@@ -1,15 +1,99 @@
 /*
  * mm.c
  *
- * Use 16 segregated free lists. The first 8 list have 8 bytes step,
- * while the last 8 lists have 32 bytes step.
- * The first 48 words of the heap are allocated as the head nodes of
- * the segregated free lists.
- * Every free block contains a 4 bytes header, a 4 bytes footer,
- * a 4 bytes successor pointer, plus a 4 bytes predecessor pointer.
- * Blocks are at least 16 bytes with an alignment of 8 bytes.
+ * Use NUMBER segregated free lists. The small lists are given by the
+ * small_class table, one list per 16 bytes of block size up to
+ * SMALL_LIMIT; the large lists cover one power of two each, and the
+ * last one takes everything bigger.
+ * Each arena has the head nodes of its own segregated free lists.
+ * Every free block contains a header, a footer, a 4 bytes successor
+ * link, plus a 4 bytes predecessor link. A link counts 16-byte units
+ * from the start of the heap, so it reaches LINK_REACH bytes; if the
+ * heap grows beyond that, widen_links turns every link into a full
+ * 8-byte pointer, which the same slots have room for. The first block
+ * of a list has no predecessor. Allocated blocks have
+ * no footer: bit 1 of each header tells whether the previous block is
+ * allocated, and only a free previous block is found through its
+ * footer. Blocks are at least 32 bytes with an alignment of 16 bytes,
+ * except for 16-byte mini blocks which serve requests of up to 8 bytes.
+ * A free mini block has room for its header and one 8-byte slot: a
+ * compact successor link and, in the second half, a compact predecessor
+ * link, so list 0 unlinks them in constant time. Wide links fill the
+ * slot, so then the list is singly linked. Bit 2 of a header tells that
+ * the previous block is a mini block.
+ * Free blocks of the classes from TREE_CLASS up are not kept on lists
+ * but in a treap ordered by size, then address, so find_fit gets the
+ * best fit among them. The left and right links take the place of the
+ * successor and predecessor pointers, and the priority of a node is a
+ * hash of its address.
+ *
+ * The heap is split into ARENAS arenas, each with its own lists, treap,
+ * slabs and lock. A thread is given an arena round-robin the first time
+ * it allocates. An arena grows in chunks of the brk heap: a chunk starts
+ * with a marker linking the arena's chunks and ends with an epilogue,
+ * so blocks of different arenas are never neighbours. The upper half of
+ * a block header holds the id of its arena, so free takes the lock of
+ * the arena that owns the block. brk_lock serializes the calls into
+ * memlib. In front of the arenas every thread keeps a small cache of
+ * freed blocks for each of the first TCACHE_CLASSES lists, so most
+ * small malloc and free calls never take a lock. A block freed by a
+ * thread of another arena that does not fit in its cache is pushed onto
+ * the remote stack of its arena with a compare-and-swap, still marked
+ * allocated. The next thread to allocate from or free into that arena
+ * under its lock takes the whole stack and frees the blocks, and so
+ * does the exit of a thread. Blocks pushed onto the arena of a thread
+ * that never calls malloc or free again wait there until another
+ * thread of the arena does.
+ *
+ * Requests of up to SLAB_MAX bytes are served from slabs instead. A
+ * slab is a page-aligned heap block of SLAB_SIZE bytes holding objects
+ * of one size with no headers; a bitmap at the start of the page tells
+ * which slots are free. slab_pages marks the heap pages that are slabs,
+ * so free finds the slab of a pointer from its address alone. A slab
+ * whose last object is freed goes back to the segregated lists. Each
+ * arena counts the live objects of every slab class, in slabs or in
+ * ordinary blocks, and only carves a new slab for a class once its live
+ * objects would fill one; until then they get ordinary blocks, so a
+ * handful of small objects does not take a page each. The thread cache
+ * keeps up to SLAB_CACHE_COUNT objects of each class from the slabs of
+ * the thread's arena: a malloc that misses it fills half of it from the
+ * slabs under the lock, and a free that finds it full gives half back.
+ *
+ * Requests of at least MMAP_THRESHOLD bytes get a region of their own
+ * from mem_map, above the brk heap, and give it back as soon as they
+ * are freed. The first 8 bytes of the region hold its length and the
+ * next 8 the id of the arena of the thread that mapped it.
+ *
+ * When a free leaves a block of at least TRIM_THRESHOLD bytes at the
+ * end of the heap, all but TRIM_PAD bytes of it go back to memlib, so
+ * the next growth of the heap does not call mem_sbrk right away.
+ *
+ * Built with DEFER_COALESCE, heap_free does not coalesce blocks of the
+ * first QUICK_CLASSES lists. It pushes them onto quick lists, still
+ * marked allocated, and malloc reuses them as they are. The quick lists
+ * are swept into the segregated lists, coalescing every block, when
+ * they hold more than QUICK_WATERMARK bytes or before the heap grows.
+ *
+ * mm_malloc_batch cuts all of its objects out of one heap block, and
+ * mm_free_batch sorts its pointers so that every run of neighbouring
+ * blocks is coalesced once.
+ *
+ * Built with MM_STATS, the allocator counts malloc and free calls per
+ * class, find_fit probes, splits, merges and heap extensions since the
+ * last mm_init. A call counts in the class of the block, slab slot or
+ * region it hands out or takes back, and a realloc that does without
+ * malloc and free counts as one of each, so every block freed evens out
+ * its class. mm_stats copies the counts out together with the free
+ * bytes of each class; without MM_STATS every count is compiled away.
+ *
+ * Built with CHECK_HEAP, every operation checks the blocks it placed,
+ * coalesced or grew on its way out of its arena: their neighbours,
+ * headers and footers, and the list or treap links of the free ones.
+ * Every CHECK_INTERVAL operations, and after one that touched more
+ * than TOUCHED_MAX blocks, the whole heap is checked instead.
  */
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,42 +127,337 @@
 #define WSIZE 8
 
 #define DSIZE 16
+
+/* header bits: the previous block is allocated, the previous block is mini */
+#define PREV_ALLOC 0x2
+#define PREV_MINI 0x4
+
+/* size of a mini block and the list that holds them */
+#define MINI_BLOCK 16
+#define MINI_CLASS 0
 #define CHUNKSIZE (1 << 9) // extend heap by this amount (bytes)
 
 
 /* Given black ptr bp, computer address of previous and next free block on free block linked list */
 
 
+/*
+ * Size-class layout. Block sizes up to SMALL_LIMIT are looked up in
+ * small_class, larger ones get one class per power of two. Each small
+ * class holds exactly one block size: the thread cache and the quick
+ * lists hand out the first block of a small list without looking at its
+ * size. To change the layout, edit the table and keep SMALL_CLASSES in
+ * step with it; the asserts below the table fail if the table or the
+ * class count no longer has one entry per size.
+ */
+#define SMALL_LIMIT 256
+#define LOG2_SMALL_LIMIT 8
+#define SMALL_CLASSES 16
+#define LARGE_CLASSES 14
+
 /* the number of free lists */
-#define NUMBER 16
+#define NUMBER (SMALL_CLASSES + LARGE_CLASSES)
+
+/* arenas the heap is split into */
+#define ARENAS 4
+
+/* classes from TREE_CLASS up live in the treap: blocks above 1 KB */
+#define TREE_CLASS (SMALL_CLASSES + 2)
+
+/* lists served by the thread cache, and blocks cached per list */
+#define TCACHE_CLASSES SMALL_CLASSES
+#define TCACHE_COUNT 7
+/* slab objects cached per class; a full bin gives half of them back */
+#define SLAB_CACHE_COUNT 16
+
+/* slab geometry: one page per slab, objects of up to SLAB_MAX bytes */
+#define SLAB_SIZE 4096
+#define LOG2_SLAB_SIZE 12
+#define SLAB_MAX 64
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+#define SLAB_MAP_WORDS (SLAB_SIZE / ALIGNMENT / 64)
+/* heap pages covered by slab_pages, enough for the whole dense heap */
+#define SLAB_PAGES (1 << 15)
+
+/* requests from this size up are mapped on their own */
+#define MMAP_THRESHOLD (1 << 18)
+
+/* lists whose frees are deferred, and bytes they may hold before a sweep */
+#ifdef DEFER_COALESCE
+#define QUICK_CLASSES SMALL_CLASSES
+#else
+#define QUICK_CLASSES 0
+#endif
+#define QUICK_WATERMARK (1 << 16)
+
+/* compact links count 16-byte units, so they reach 64 GB into the heap */
+#define LINK_REACH (1UL << 36)
+
+/* trim a free top block this big down to TRIM_PAD bytes */
+#define TRIM_THRESHOLD (1 << 18)
+#define TRIM_PAD (1 << 16)
+
+/* check the blocks each operation touches, and the heap now and then */
+#ifdef CHECK_HEAP
+#define CHECK 1
+#else
+#define CHECK 0
+#endif
+#define CHECK_INTERVAL 1024
+#define TOUCHED_MAX 32
+
+/* keep the counters reported by mm_stats */
+#ifdef MM_STATS
+#define STATS 1
+#else
+#define STATS 0
+#endif
+
+/*
+ * Per-thread cache of freed blocks, one stack per size class, and of
+ * slab objects of the thread's arena, one stack per slab class.
+ * Cached blocks keep their allocated bit and cached objects their slot,
+ * so they are never coalesced, and the first 8 bytes of the payload
+ * link them together.
+ * generation tells whether the cache belongs to the current heap.
+ */
+typedef struct {
+    unsigned long generation;
+    void *bins[TCACHE_CLASSES];
+    unsigned int counts[TCACHE_CLASSES];
+    void *slabs[SLAB_CLASSES];
+    unsigned int slab_counts[SLAB_CLASSES];
+    bool registered;
+} tcache_t;
+
+/*
+ * Slab header, at the start of the page. The objects follow it up to
+ * the header of the next heap block. Slabs with a free slot are kept on
+ * the doubly linked list of their class.
+ */
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    unsigned int size;                      /* object size */
+    unsigned int count;                     /* objects in use */
+    unsigned long free_map[SLAB_MAP_WORDS]; /* bit set if the slot is free */
+} slab_t;
+
+/*
+ * Arena state. Everything in it is protected by lock; the functions
+ * below reach it through arena, the arena whose lock the thread holds.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned int id;                         /* index in arenas */
+    unsigned long heads[NUMBER];             /* link to the first block of each list */
+    unsigned long free_lists_map;            /* bit i set if list i is non-empty */
+    unsigned long tree_root;                 /* link to the root of the treap */
+    bool wide_links;                         /* links are full pointers */
+    char *chunk;                             /* marker of the newest chunk */
+    void *quick_lists[SMALL_CLASSES];        /* freed blocks not coalesced yet */
+    size_t quick_bytes;                      /* bytes on the quick lists */
+    slab_t *slab_lists[SLAB_CLASSES];        /* slabs with a free slot */
+    long small_live[SLAB_CLASSES];           /* live objects of each slab class */
+    void *remote;                            /* blocks freed by other threads, lock-free */
+    mm_stats_t stats;                        /* counters since the last mm_init */
+    void *touched[TOUCHED_MAX];              /* blocks touched under lock */
+    unsigned int touched_count;              /* may exceed TOUCHED_MAX */
+    unsigned long check_count;               /* operations checked */
+} arena_t;
+
+/* objects start at the first aligned address after the header */
+#define SLAB_HEADER ((sizeof(slab_t) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+/* a slab block ends where the header of the next block starts */
+#define SLAB_ROOM (SLAB_SIZE - SLAB_HEADER - WSIZE)
 
 /* Global variables */
 static inline void *int_to_ptr(unsigned int n);
 
 static inline unsigned int ptr_to_int(void *p);
 
-static char *heap_listp;
-static unsigned long offset;
+static inline void *get_link(const void *slot);
+
+static inline void set_link(void *slot, void *p);
+
+/* small_class[n] is the list for block sizes in (16 * (n - 1), 16 * n] */
+static const unsigned char small_class[] = {
+    0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+_Static_assert(sizeof small_class == SMALL_LIMIT / ALIGNMENT + 1,
+               "small_class has an entry for every small block size");
+_Static_assert(SMALL_CLASSES == SMALL_LIMIT / ALIGNMENT,
+               "each small class holds exactly one block size");
+
+_Static_assert(SMALL_LIMIT == 1 << LOG2_SMALL_LIMIT,
+               "SMALL_LIMIT must be 2^LOG2_SMALL_LIMIT");
+_Static_assert(NUMBER <= 64, "free_lists_map has one bit per list");
+_Static_assert(SLAB_SIZE == 1 << LOG2_SLAB_SIZE,
+               "SLAB_SIZE must be 2^LOG2_SLAB_SIZE");
+_Static_assert(SLAB_MAX % ALIGNMENT == 0, "slab objects are aligned");
+_Static_assert(NUMBER <= MM_STATS_CLASSES, "mm_stats_t has a slot per list");
+
+static char *heap_listp;                /* start of the heap, 0 before init_heap */
+static char *link_base;                 /* compact links count from here */
+static int top_arena;                   /* owner of the chunk at the top, or -1 */
+
+static arena_t arenas[ARENAS] = {
+    [0 ... ARENAS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static __thread arena_t *arena;         /* the arena whose lock is held */
+static __thread arena_t *thread_arena;  /* the arena this thread allocates from */
+static unsigned int next_arena;         /* round-robin arena assignment */
+static pthread_mutex_t brk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long heap_generation;   /* bumped by every mm_init */
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+static unsigned long slab_pages[SLAB_PAGES / 64]; /* bit set if the page is a slab */
 
 /* Function prototypes for internal helper routines */
+static void init_heap(void);
+
+static void lock_arenas(void);
+
+static void unlock_arenas(void);
+
+static arena_t *my_arena(void);
+
+static arena_t *arena_of(void *bp);
+
+static void arena_lock(arena_t *a);
+
+static void arena_unlock(void);
+
+static void touch_block(void *bp);
+
+static void untouch_block(void *bp);
+
+static void *heap_malloc(size_t asize);
+
+static void split_batch(void *bp, size_t asize, size_t n, void **ptrs);
+
+static int compare_ptr(const void *a, const void *b);
+
+static void heap_free(void *ptr);
+
+static void free_block(void *ptr);
+
+static bool quick_put(void *bp);
+
+static void *quick_get(size_t asize);
+
+static bool quick_sweep(void);
+
+static void remote_push(arena_t *a, void *ptr);
+
+static bool remote_drain(void);
+
+static void *tcache_get(size_t asize);
+
+static bool tcache_put(void *bp);
+
+static void tcache_reset(void);
+
+static void tcache_register(void);
+
+static bool tcache_drain(tcache_t *tc);
+
+static void tcache_flush(void *arg);
+
+static void tcache_make_key(void);
+
+static void *slab_malloc(size_t size, size_t want);
+
+static void slab_free(slab_t *slab, void *ptr);
+
+static void *slab_cache_get(size_t size);
+
+static bool slab_cache_put(void *ptr, int index);
+
+static void slab_cache_fill(size_t size);
+
+static void slab_cache_flush(int index, unsigned int n);
+
+static slab_t *slab_of(const void *ptr);
+
+static void *slab_block(void);
+
+static void slab_link(slab_t *slab);
+
+static void slab_unlink(slab_t *slab);
+
+static void slab_mark(const void *page, bool on);
+
+static void checkslab(slab_t *slab);
+
+static void count_small(void *bp, long n);
+
+static void *map_malloc(size_t size);
+
+static void map_free(void *ptr);
+
+static void *map_realloc(void *ptr, size_t size);
+
+static bool is_mapped(const void *ptr);
+
+static void count_ops(unsigned long *counts, size_t asize, size_t n);
+
+static void *count_ptr(unsigned long *counts, void *ptr);
+
+static void *count_fit(void *bp, unsigned long probes);
+
 static int in_heap(const void *p);
 
 static int aligned(const void *p);
 
 static void *extend_heap(size_t words);
 
+static void widen_links(void);
+
+static void widen_link(void *slot);
+
 static void place(void *bp, size_t asize);
 
+static void shrink_block(void *bp, size_t asize);
+
+static bool grow_block(void *bp, size_t asize);
+
 static int get_block_size(size_t size);
 
 static void *find_fit(size_t asize);
 
+static void *list_head(int index);
+
 static void add_free_block(void *bp);
 
 static void delete_free_block(void *bp);
 
+static void delete_mini_block(void *bp);
+
+static void *tree_left(void *bp);
+
+static void *tree_right(void *bp);
+
+static bool tree_less(void *a, void *b);
+
+static unsigned int tree_priority(void *bp);
+
+static void tree_insert(void *link, void *bp);
+
+static void tree_delete(void *bp);
+
+static void *tree_fit(size_t asize, unsigned long *probes);
+
+static void checktree(void *bp, void *lo, void *hi);
+
 static void *coalesce(void *bp);
 
+static void trim_heap(void *bp);
+
 static void printblock(void *bp);
 
 static void checkcoalescing(void *bp);
@@ -87,12 +466,20 @@ static void checkfreelist(void *bp, int index);
 
 static void checkheap(int verbose);
 
+static void checklocal(void *bp);
+
+static void checklinks(void *bp);
+
 static void checkblock(void *bp);
 
 static size_t align(size_t p);
 
 static size_t max(size_t x, size_t y);
 
+static size_t min(size_t x, size_t y);
+
+static size_t adjust_size(size_t size);
+
 static unsigned int pack(int size, int alloc);
 
 static unsigned int get(void *p);
@@ -103,6 +490,12 @@ static size_t get_size(void *p);
 
 static size_t get_alloc(void *p);
 
+static size_t get_prev_alloc(void *p);
+
+static size_t get_prev_bits(void *p);
+
+static void set_next_prev(void *bp);
+
 static char *get_header(void *bp);
 
 static char *get_footer(void *bp);
@@ -111,9 +504,13 @@ static char *next_block(void *bp);
 
 static char *prev_block(void *bp);
 
-static unsigned int next_free_block(void *bp);
+static void *next_free_block(void *bp);
+
+static void *prev_free_block(void *bp);
 
-static unsigned int prev_free_block(void *bp);
+static void *prev_mini_block(void *bp);
+
+static void set_prev_mini(void *bp, void *prev);
 
 static size_t align(size_t p) {
     return ((size_t)(p) + (ALIGNMENT - 1)) & ~0xF;
@@ -123,18 +520,36 @@ static size_t max(size_t x, size_t y) {
     return x > y ? x : y;
 }
 
+static size_t min(size_t x, size_t y) {
+    return x < y ? x : y;
+}
+
+/* Block size for a request of size bytes: header, payload and alignment */
+static size_t adjust_size(size_t size) {
+    if (size <= WSIZE)
+        return MINI_BLOCK;
+    if (size <= DSIZE + WSIZE)
+        return 2 * DSIZE;
+    return align(size + WSIZE);
+}
+
 /* Pack a size and allocated bit into a word */
 static unsigned int pack(int size, int alloc) {
     return (unsigned int) (size | alloc);
 }
 
-/* Read and write a word at address p */
+/*
+ * Read and write a word at address p. Threads that do not hold the
+ * arena lock read the headers of their own blocks while set_next_prev
+ * updates them, so the lower half is read atomically.
+ */
 static unsigned int get(void *p) {
-    return *(unsigned int *) (p);
+    return __atomic_load_n((unsigned int *) (p), __ATOMIC_RELAXED);
 }
 
+/* The upper half of the word written holds the id of the locked arena */
 static void put(void *p, size_t val) {
-    *(unsigned long *) (p) = (val);
+    *(unsigned long *) (p) = (val) | (unsigned long) arena->id << 32;
 }
 
 /* Read the size and allocated fields from address p */
@@ -146,161 +561,1171 @@ static size_t get_alloc(void *p) {
     return get(p) & 0x1;
 }
 
+static size_t get_prev_alloc(void *p) {
+    return get(p) & PREV_ALLOC;
+}
+
+/* Read the bits describing the previous block from address p */
+static size_t get_prev_bits(void *p) {
+    return get(p) & (PREV_ALLOC | PREV_MINI);
+}
+
+/*
+ * Record in the header of the block after bp how bp looks. That block
+ * may be allocated and its owner reading the header, so only the lower
+ * half is stored, atomically, and the arena id is left alone.
+ */
+static void set_next_prev(void *bp) {
+    char *hp = get_header(next_block(bp));
+    size_t bits = 0;
+
+    if (get_alloc(get_header(bp)))
+        bits |= PREV_ALLOC;
+    if (get_size(get_header(bp)) == MINI_BLOCK)
+        bits |= PREV_MINI;
+    bits |= get(hp) & ~(PREV_ALLOC | PREV_MINI);
+    __atomic_store_n((unsigned int *) hp, (unsigned int) bits, __ATOMIC_RELAXED);
+}
+
 /* Given block ptr bp, compute address of its header and footer */
 static char *get_header(void *bp) {
     return (char *) (bp) - WSIZE;
 }
 
-static char *get_footer(void *bp) {
-    return (char *) (bp) + get_size(get_header(bp)) - DSIZE;
+static char *get_footer(void *bp) {
+    return (char *) (bp) + get_size(get_header(bp)) - DSIZE;
+}
+
+/* Given block ptr bp, compute address of next and previous blocks */
+static char *next_block(void *bp) {
+    return (char *) (bp) + get_size(((char *) (bp) - WSIZE));
+}
+
+static char *prev_block(void *bp) {
+    /* a mini block has no footer, but its size is known */
+    if (get(get_header(bp)) & PREV_MINI)
+        return (char *) (bp) - MINI_BLOCK;
+    return (char *) (bp) - get_size(((char *) (bp) - DSIZE));
+}
+
+/* Given free block ptr bp, compute its successor and predecessor on its list */
+static void *next_free_block(void *bp) {
+    return get_link(bp);
+}
+
+static void *prev_free_block(void *bp) {
+    return get_link((char *) (bp) + WSIZE);
+}
+
+/* The predecessor of free mini block bp, kept while links are compact */
+static void *prev_mini_block(void *bp) {
+    return int_to_ptr(*((unsigned int *) bp + 1));
+}
+
+static void set_prev_mini(void *bp, void *prev) {
+    *((unsigned int *) bp + 1) = ptr_to_int(prev);
+}
+
+
+
+/*
+ * Initialize: return -1 on error, 0 on success.
+ */
+
+/* convert a 4-byte link, in 16-byte units from link_base, to an address */
+static inline void *int_to_ptr(unsigned int n) {
+    return n == 1U ? NULL : link_base + ((unsigned long) n << 4);
+}
+
+/* convert a block address to a 4-byte link; 1 is never a block */
+static inline unsigned int ptr_to_int(void *p) {
+    return p == NULL ? 1U : (unsigned int) (((char *) p - link_base) >> 4);
+}
+
+/* Read and write the link in slot, compact or wide */
+static inline void *get_link(const void *slot) {
+    if (arena->wide_links)
+        return *(void * const *) slot;
+    return int_to_ptr(*(const unsigned int *) slot);
+}
+
+static inline void set_link(void *slot, void *p) {
+    if (arena->wide_links)
+        *(void **) slot = p;
+    else
+        *(unsigned int *) slot = ptr_to_int(p);
+}
+
+bool mm_init(void) {
+    lock_arenas();
+    init_heap();
+    unlock_arenas();
+    return true;
+}
+
+/*
+ * init_heap - reset every arena to an empty heap, called with all the
+ * arena locks held. An arena adds its first chunk when it first needs
+ * memory.
+ */
+static void init_heap(void) {
+    /* Blocks cached by any thread belong to the old heap */
+    heap_generation++;
+    heap_listp = mem_heap_lo();
+    /* link 1 stands for NULL and falls on the marker of the first chunk */
+    link_base = heap_listp - DSIZE;
+    top_arena = -1;
+    memset(slab_pages, 0, sizeof(slab_pages));
+    for (unsigned int i = 0; i < ARENAS; i++) {
+        arena = &arenas[i];
+        arena->id = i;
+        arena->wide_links = false;
+        for (int j = 0; j < NUMBER; j++)
+            set_link(list_head(j), NULL);
+        arena->free_lists_map = 0;
+        set_link(&arena->tree_root, NULL);
+        arena->chunk = NULL;
+        for (int j = 0; j < SMALL_CLASSES; j++)
+            arena->quick_lists[j] = NULL;
+        arena->quick_bytes = 0;
+        for (int j = 0; j < SLAB_CLASSES; j++) {
+            arena->slab_lists[j] = NULL;
+            arena->small_live[j] = 0;
+        }
+        arena->remote = NULL;
+        memset(&arena->stats, 0, sizeof(arena->stats));
+        arena->touched_count = 0;
+    }
+    arena = NULL;
+}
+
+/* Take every arena lock, always in the same order */
+static void lock_arenas(void) {
+    for (int i = 0; i < ARENAS; i++)
+        pthread_mutex_lock(&arenas[i].lock);
+}
+
+static void unlock_arenas(void) {
+    for (int i = 0; i < ARENAS; i++)
+        pthread_mutex_unlock(&arenas[i].lock);
+}
+
+/*
+ * my_arena - the arena the calling thread allocates from, handed out
+ * round-robin on its first call. Set up the heap if mm_init was not
+ * called.
+ */
+static arena_t *my_arena(void) {
+    if (heap_listp == 0) {
+        lock_arenas();
+        if (heap_listp == 0)
+            init_heap();
+        unlock_arenas();
+    }
+    if (thread_arena == NULL)
+        thread_arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % ARENAS];
+    return thread_arena;
+}
+
+/*
+ * The arena that owns block bp, from the upper half of its header.
+ * Called without the lock; no thread rewrites the id of a live block.
+ */
+static arena_t *arena_of(void *bp) {
+    return &arenas[__atomic_load_n((unsigned int *) get_header(bp) + 1, __ATOMIC_RELAXED)];
+}
+
+/* Take the lock of a, whose state the helpers below then work on */
+static void arena_lock(arena_t *a) {
+    pthread_mutex_lock(&a->lock);
+    arena = a;
+}
+
+/*
+ * arena_unlock - release the lock of the arena. Built with CHECK_HEAP,
+ * first check the blocks touched since it was taken, or the whole arena
+ * every CHECK_INTERVAL operations and when too many blocks were touched.
+ */
+static void arena_unlock(void) {
+    if (CHECK && heap_listp != 0) {
+        if (++arena->check_count % CHECK_INTERVAL == 0 || arena->touched_count > TOUCHED_MAX) {
+            checkheap(0);
+        } else {
+            for (unsigned int i = 0; i < arena->touched_count; i++)
+                checklocal(arena->touched[i]);
+        }
+        arena->touched_count = 0;
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/* Remember that bp was changed, for arena_unlock to check */
+static void touch_block(void *bp) {
+    if (!CHECK)
+        return;
+    for (unsigned int i = 0; i < arena->touched_count && i < TOUCHED_MAX; i++) {
+        if (arena->touched[i] == bp)
+            return;
+    }
+    if (arena->touched_count < TOUCHED_MAX)
+        arena->touched[arena->touched_count] = bp;
+    arena->touched_count++;
+}
+
+/* Forget bp, which has been merged into another block */
+static void untouch_block(void *bp) {
+    /* after an overflow the whole heap is checked anyway */
+    if (!CHECK || arena->touched_count > TOUCHED_MAX)
+        return;
+    for (unsigned int i = 0; i < arena->touched_count; i++) {
+        if (arena->touched[i] == bp) {
+            arena->touched[i] = arena->touched[--arena->touched_count];
+            return;
+        }
+    }
+}
+
+/*
+ * malloc - try the thread cache first, slab objects before blocks, then
+ * the slabs of the arena once their class has enough live objects, then
+ * the shared heap. The arena lock is only taken when the cache misses.
+ */
+void *malloc(size_t size) {
+    size_t asize;      /* Adjusted block size */
+    char *bp;
+    arena_t *a;
+
+//    dbg_printf("malloc(%zd)\n", size);
+
+    /* Ignore spurious requests */
+    if (size == 0)
+        return NULL;
+    a = my_arena();
+    if (size >= MMAP_THRESHOLD)
+        return count_ptr(a->stats.mallocs, map_malloc(size));
+    if (size <= SLAB_MAX && (bp = slab_cache_get(size)) != NULL)
+        return count_ptr(a->stats.mallocs, bp);
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = adjust_size(size);
+    if ((bp = tcache_get(asize)) != NULL) {
+        count_small(bp, 1);
+        return count_ptr(a->stats.mallocs, bp);
+    }
+    arena_lock(a);
+    if (size <= SLAB_MAX && (bp = slab_malloc(size, 1)) != NULL)
+        slab_cache_fill(size);
+    else if ((bp = heap_malloc(asize)) != NULL)
+        count_small(bp, 1);
+    arena_unlock();
+    return count_ptr(a->stats.mallocs, bp);
+}
+
+/*
+ * heap_malloc - allocate asize bytes from the segregated lists of the
+ * locked arena.
+ */
+static void *heap_malloc(size_t asize) {
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;
+
+    bool drained;
+
+    remote_drain();
+    if ((bp = quick_get(asize)) != NULL)
+        return bp;
+    /* Search the free list for a fit */
+    if ((bp = find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+    /* Let the cached and deferred blocks coalesce before growing the heap */
+    drained = tcache_drain(&tcache);
+    if (remote_drain())
+        drained = true;
+    if ((quick_sweep() || drained) && (bp = find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+    /* No fit found. Get more memory and place the block */
+    extendsize = max(asize, CHUNKSIZE);
+    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+        return NULL;
+    place(bp, asize);
+    return bp;
+}
+
+/*
+ * free - keep the block in the thread cache if there is room,
+ * otherwise give it back to the arena that owns it, or to its remote
+ * stack if the arena is not the calling thread's. A slab object of the
+ * thread's arena that finds its bin full goes back with half the bin.
+ */
+void free(void *ptr) {
+    slab_t *slab;
+    arena_t *a;
+
+    if (ptr == 0)
+        return;
+    /* the page of a live object stays a slab, so no lock is needed here */
+    if ((slab = slab_of(ptr)) != NULL) {
+        a = arena_of(slab);
+        count_ptr(a->stats.frees, ptr);
+        if (a != thread_arena) {
+            remote_push(a, ptr);
+            return;
+        }
+        if (slab_cache_put(ptr, slab->size / ALIGNMENT - 1))
+            return;
+        arena_lock(a);
+        slab_cache_flush(slab->size / ALIGNMENT - 1, SLAB_CACHE_COUNT / 2);
+        slab_free(slab, ptr);
+        remote_drain();
+        arena_unlock();
+        return;
+    }
+    if (is_mapped(ptr)) {
+        map_free(ptr);
+        return;
+    }
+    a = arena_of(ptr);
+    count_ptr(a->stats.frees, ptr);
+    count_small(ptr, -1);
+    if (tcache_put(ptr))
+        return;
+    if (a != thread_arena) {
+        remote_push(a, ptr);
+        return;
+    }
+
+    arena_lock(a);
+    heap_free(ptr);
+    remote_drain();
+    arena_unlock();
+}
+
+/*
+ * heap_free - return a block to the quick lists or the segregated
+ * lists of the locked arena, which owns it.
+ */
+static void heap_free(void *ptr) {
+    if (!quick_put(ptr))
+        free_block(ptr);
+}
+
+/* free_block - coalesce a block into the segregated lists */
+static void free_block(void *ptr) {
+    size_t size = get_size(get_header(ptr));
+
+    /* coalesce writes the footer and tells the next block */
+    put(get_header(ptr), pack(size, get_prev_bits(get_header(ptr))));
+    trim_heap(coalesce(ptr));
+}
+
+/*
+ * mm_malloc_batch - allocate n objects of size bytes and store them in
+ * ptrs. Return the number allocated, which is less than n only if the
+ * heap runs out of memory.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs) {
+    size_t asize, k, i = 0;
+    char *bp;
+    arena_t *a;
+
+    if (size == 0)
+        return 0;
+    a = my_arena();
+    /* like malloc, map regions without holding the arena lock */
+    if (size >= MMAP_THRESHOLD) {
+        while (i < n && (ptrs[i] = map_malloc(size)) != NULL)
+            count_ptr(a->stats.mallocs, ptrs[i++]);
+        return i;
+    }
+    arena_lock(a);
+    if (size <= SLAB_MAX) {
+        while (i < n && (ptrs[i] = slab_malloc(size, n - i)) != NULL)
+            i++;
+    }
+    asize = adjust_size(size);
+    /*
+     * Cut the others out of one free block that holds them all, or else
+     * out of as many free blocks as it takes, before growing the heap.
+     * A block is cut for fewer than MMAP_THRESHOLD bytes of objects at a
+     * time, so its size stays far from what a header cannot hold.
+     */
+    while (i < n) {
+        k = min(n - i, max(MMAP_THRESHOLD / asize, 1));
+        if ((bp = find_fit(asize * k)) == NULL && (bp = find_fit(asize)) != NULL)
+            k = get_size(get_header(bp)) / asize;
+        if (bp != NULL) {
+            place(bp, asize * k);
+        } else {
+            /* if the heap cannot grow by all of them, try for fewer */
+            while ((bp = heap_malloc(asize * k)) == NULL && k > 1)
+                k /= 2;
+            if (bp == NULL)
+                break;
+        }
+        split_batch(bp, asize, k, ptrs + i);
+        for (size_t j = i; j < i + k; j++)
+            count_small(ptrs[j], 1);
+        i += k;
+    }
+    arena_unlock();
+    /* only the objects handed out count, by the blocks they got */
+    for (k = 0; STATS && k < i; k++)
+        count_ptr(a->stats.mallocs, ptrs[k]);
+    return i;
+}
+
+/*
+ * split_batch - cut allocated block bp into n blocks of asize bytes,
+ * the last one keeping any slack, and store them in ptrs.
+ */
+static void split_batch(void *bp, size_t asize, size_t n, void **ptrs) {
+    size_t csize = get_size(get_header(bp));
+    size_t prev_bits = get_prev_bits(get_header(bp));
+    size_t next_bits = asize == MINI_BLOCK ? PREV_ALLOC | PREV_MINI : PREV_ALLOC;
+    char *p = bp;
+
+    if (STATS)
+        arena->stats.splits += n - 1;
+    for (size_t i = 0; i < n - 1; i++) {
+        put(get_header(p), pack(asize, prev_bits | 1));
+        ptrs[i] = p;
+        p += asize;
+        csize -= asize;
+        prev_bits = next_bits;
+    }
+    put(get_header(p), pack(csize, prev_bits | 1));
+    ptrs[n - 1] = p;
+    set_next_prev(p);
+}
+
+/*
+ * mm_free_batch - free the n pointers in ptrs. ptrs is sorted by
+ * address, so each run of neighbouring blocks becomes one free block
+ * and is coalesced once. The lock of an arena is held for as long as
+ * the pointers belong to it.
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    size_t i, j, size;
+    slab_t *slab;
+    arena_t *a, *held = NULL;
+    char *p;
+
+    qsort(ptrs, n, sizeof(*ptrs), compare_ptr);
+    for (i = 0; i < n; i = j) {
+        p = ptrs[i];
+        j = i + 1;
+        if (p == NULL)
+            continue;
+        if (is_mapped(p)) {
+            map_free(p);
+            continue;
+        }
+        slab = slab_of(p);
+        if ((a = arena_of(slab != NULL ? (void *) slab : p)) != held) {
+            if (held != NULL)
+                arena_unlock();
+            arena_lock(a);
+            held = a;
+        }
+        if (slab != NULL) {
+            count_ptr(arena->stats.frees, p);
+            slab_free(slab, p);
+            continue;
+        }
+        size = get_size(get_header(p));
+        count_ops(arena->stats.frees, size, 1);
+        count_small(p, -1);
+        for (; j < n && (char *) ptrs[j] == p + size; j++) {
+            count_ops(arena->stats.frees, get_size(get_header(ptrs[j])), 1);
+            count_small(ptrs[j], -1);
+            size += get_size(get_header(ptrs[j]));
+        }
+        if (STATS)
+            arena->stats.coalesces += j - i - 1;
+        put(get_header(p), pack(size, get_prev_bits(get_header(p))));
+        trim_heap(coalesce(p));
+    }
+    if (held != NULL)
+        arena_unlock();
+}
+
+static int compare_ptr(const void *a, const void *b) {
+    const char *x = *(char * const *) a;
+    const char *y = *(char * const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * quick_put - defer the free of bp if its list has a quick list.
+ * Sweep the quick lists once they hold more than QUICK_WATERMARK bytes.
+ */
+static bool quick_put(void *bp) {
+    size_t size = get_size(get_header(bp));
+    int index = get_block_size(size);
+
+    if (index >= QUICK_CLASSES)
+        return false;
+    *(void **) bp = arena->quick_lists[index];
+    arena->quick_lists[index] = bp;
+    arena->quick_bytes += size;
+    if (arena->quick_bytes > QUICK_WATERMARK)
+        quick_sweep();
+    return true;
+}
+
+/* Pop a deferred block of asize bytes, or return NULL */
+static void *quick_get(size_t asize) {
+    int index = get_block_size(asize);
+    void *bp;
+
+    /* a small list holds a single block size */
+    if (index >= QUICK_CLASSES || (bp = arena->quick_lists[index]) == NULL)
+        return NULL;
+    arena->quick_lists[index] = *(void **) bp;
+    arena->quick_bytes -= asize;
+    return bp;
+}
+
+/* Coalesce every deferred block. Return whether there were any */
+static bool quick_sweep(void) {
+    bool swept = false;
+    void *bp;
+
+    for (int i = 0; i < QUICK_CLASSES; i++) {
+        while ((bp = arena->quick_lists[i]) != NULL) {
+            arena->quick_lists[i] = *(void **) bp;
+            free_block(bp);
+            swept = true;
+        }
+    }
+    arena->quick_bytes = 0;
+    return swept;
+}
+
+/*
+ * remote_push - push ptr onto the remote stack of arena a without
+ * taking its lock. The first 8 bytes of the payload link the stack.
+ */
+static void remote_push(arena_t *a, void *ptr) {
+    void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+    do {
+        *(void **) ptr = head;
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, ptr, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * remote_drain - free every block on the remote stack of the locked
+ * arena. Return whether there were any.
+ */
+static bool remote_drain(void) {
+    void *ptr, *next;
+    slab_t *slab;
+
+    /* only lock holders take the stack, so a plain load rules it out */
+    if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) == NULL)
+        return false;
+    ptr = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; ptr != NULL; ptr = next) {
+        next = *(void **) ptr;
+        if ((slab = slab_of(ptr)) != NULL)
+            slab_free(slab, ptr);
+        else
+            heap_free(ptr);
+    }
+    return true;
+}
+
+/*
+ * tcache_get - pop a cached block of asize bytes from the calling
+ * thread's cache, or return NULL.
+ */
+static void *tcache_get(size_t asize) {
+    int index = get_block_size(asize);
+    void *bp;
+
+    if (index >= TCACHE_CLASSES)
+        return NULL;
+    if (tcache.generation != heap_generation) {
+        tcache_reset();
+        return NULL;
+    }
+    /* a small list holds a single block size, so the first block fits */
+    if ((bp = tcache.bins[index]) == NULL)
+        return NULL;
+    tcache.bins[index] = *(void **) bp;
+    tcache.counts[index]--;
+    return bp;
+}
+
+/*
+ * tcache_put - push a block onto the calling thread's cache.
+ * Return false if its class is not cached or the bin is full.
+ */
+static bool tcache_put(void *bp) {
+    int index = get_block_size(get_size(get_header(bp)));
+
+    if (index >= TCACHE_CLASSES)
+        return false;
+    if (tcache.generation != heap_generation)
+        tcache_reset();
+    if (tcache.counts[index] >= TCACHE_COUNT)
+        return false;
+    tcache_register();
+    *(void **) bp = tcache.bins[index];
+    tcache.bins[index] = bp;
+    tcache.counts[index]++;
+    return true;
+}
+
+/* Drop a cache whose blocks belong to a heap that has been reset */
+static void tcache_reset(void) {
+    for (int i = 0; i < TCACHE_CLASSES; i++) {
+        tcache.bins[i] = NULL;
+        tcache.counts[i] = 0;
+    }
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        tcache.slabs[i] = NULL;
+        tcache.slab_counts[i] = 0;
+    }
+    tcache.generation = heap_generation;
+}
+
+/* Flush the cache back to the heap when the thread exits */
+static void tcache_register(void) {
+    if (tcache.registered)
+        return;
+    pthread_once(&tcache_key_once, tcache_make_key);
+    pthread_setspecific(tcache_key, &tcache);
+    tcache.registered = true;
+}
+
+/*
+ * tcache_drain - return the blocks and slab objects cached by tc that
+ * belong to the locked arena. Return whether anything was freed.
+ */
+static bool tcache_drain(tcache_t *tc) {
+    bool drained = false;
+    void **link;
+    void *bp;
+    slab_t *slab;
+
+    if (tc->generation != heap_generation)
+        return false;
+    for (int i = 0; i < TCACHE_CLASSES; i++) {
+        for (link = &tc->bins[i]; (bp = *link) != NULL;) {
+            if (arena_of(bp) != arena) {
+                link = (void **) bp;
+                continue;
+            }
+            *link = *(void **) bp;
+            tc->counts[i]--;
+            heap_free(bp);
+            drained = true;
+        }
+    }
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        for (link = &tc->slabs[i]; (bp = *link) != NULL;) {
+            if (arena_of(slab = slab_of(bp)) != arena) {
+                link = (void **) bp;
+                continue;
+            }
+            *link = *(void **) bp;
+            tc->slab_counts[i]--;
+            slab_free(slab, bp);
+            drained = true;
+        }
+    }
+    return drained;
+}
+
+/*
+ * Thread exit destructor: return every cached block to its arena, and
+ * free the blocks other threads left on the remote stacks
+ */
+static void tcache_flush(void *arg) {
+    tcache_t *tc = (tcache_t *) arg;
+
+    for (int i = 0; i < ARENAS; i++) {
+        arena_lock(&arenas[i]);
+        tcache_drain(tc);
+        remote_drain();
+        arena_unlock();
+    }
+    tc->registered = false;
+}
+
+static void tcache_make_key(void) {
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * slab_malloc - take the lowest free slot of a slab of the class of
+ * size, carving a new slab if the class has none and want more objects
+ * would bring its live objects to a slab's worth. Return NULL if no
+ * slab is made. Called with the arena locked.
+ */
+static void *slab_malloc(size_t size, size_t want) {
+    int index = (size - 1) / ALIGNMENT;
+    slab_t *slab = arena->slab_lists[index];
+    unsigned int n, i;
+    int bit;
+
+    /* objects freed by other threads may leave a slab with room */
+    if (slab == NULL && remote_drain())
+        slab = arena->slab_lists[index];
+    if (slab == NULL) {
+        if (__atomic_load_n(&arena->small_live[index], __ATOMIC_RELAXED) + (long) want <
+            (long) (SLAB_ROOM / ((index + 1) * ALIGNMENT)))
+            return NULL;
+        if ((slab = slab_block()) == NULL)
+            return NULL;
+        slab->size = (index + 1) * ALIGNMENT;
+        slab->count = 0;
+        n = SLAB_ROOM / slab->size;
+        for (i = 0; i < SLAB_MAP_WORDS; i++, n -= n < 64 ? n : 64)
+            slab->free_map[i] = n >= 64 ? ~0UL : (1UL << n) - 1;
+        slab_link(slab);
+    }
+    for (i = 0; slab->free_map[i] == 0; i++)
+        ;
+    bit = __builtin_ctzl(slab->free_map[i]);
+    slab->free_map[i] &= ~(1UL << bit);
+    if (++slab->count == SLAB_ROOM / slab->size)
+        slab_unlink(slab);
+    __atomic_fetch_add(&arena->small_live[index], 1, __ATOMIC_RELAXED);
+    return (char *) slab + SLAB_HEADER + (i * 64 + bit) * slab->size;
+}
+
+/*
+ * slab_free - give the slot of ptr back to its slab, and the slab back
+ * to the segregated lists once it is empty. The caller counts the free.
+ * Called with its arena locked.
+ */
+static void slab_free(slab_t *slab, void *ptr) {
+    unsigned int slot = ((char *) ptr - (char *) slab - SLAB_HEADER) / slab->size;
+
+    __atomic_fetch_sub(&arena->small_live[slab->size / ALIGNMENT - 1], 1, __ATOMIC_RELAXED);
+    /* a full slab is on no list */
+    if (slab->count == SLAB_ROOM / slab->size)
+        slab_link(slab);
+    slab->free_map[slot / 64] |= 1UL << (slot % 64);
+    if (--slab->count == 0) {
+        slab_unlink(slab);
+        slab_mark(slab, false);
+        heap_free(slab);
+    }
+}
+
+/*
+ * slab_cache_get - pop a cached slab object for a request of size
+ * bytes from the calling thread's cache, or return NULL.
+ */
+static void *slab_cache_get(size_t size) {
+    int index = (size - 1) / ALIGNMENT;
+    void *ptr;
+
+    if (tcache.generation != heap_generation) {
+        tcache_reset();
+        return NULL;
+    }
+    if ((ptr = tcache.slabs[index]) == NULL)
+        return NULL;
+    tcache.slabs[index] = *(void **) ptr;
+    tcache.slab_counts[index]--;
+    return ptr;
+}
+
+/*
+ * slab_cache_put - push slab object ptr of class index onto the calling
+ * thread's cache. Return false if the bin is full.
+ */
+static bool slab_cache_put(void *ptr, int index) {
+    if (tcache.generation != heap_generation)
+        tcache_reset();
+    if (tcache.slab_counts[index] >= SLAB_CACHE_COUNT)
+        return false;
+    tcache_register();
+    *(void **) ptr = tcache.slabs[index];
+    tcache.slabs[index] = ptr;
+    tcache.slab_counts[index]++;
+    return true;
+}
+
+/*
+ * slab_cache_fill - move free slots of the slabs the class of size
+ * already has into the calling thread's cache, until its bin is half
+ * full, so the next mallocs of the class take no lock. Called with the
+ * thread's arena locked.
+ */
+static void slab_cache_fill(size_t size) {
+    int index = (size - 1) / ALIGNMENT;
+
+    while (arena->slab_lists[index] != NULL && tcache.slab_counts[index] < SLAB_CACHE_COUNT / 2)
+        slab_cache_put(slab_malloc(size, 0), index);
+}
+
+/*
+ * slab_cache_flush - give n objects of the bin of class index back to
+ * their slabs. Called with the thread's arena locked.
+ */
+static void slab_cache_flush(int index, unsigned int n) {
+    void *ptr;
+
+    for (; n > 0 && (ptr = tcache.slabs[index]) != NULL; n--) {
+        tcache.slabs[index] = *(void **) ptr;
+        tcache.slab_counts[index]--;
+        slab_free(slab_of(ptr), ptr);
+    }
+}
+
+/*
+ * count_small - add n to the live objects of the slab class that
+ * ordinary block bp could serve, if it is small enough for one. Other
+ * threads' frees change the counts too, hence the atomics.
+ */
+static void count_small(void *bp, long n) {
+    size_t size = get_size(get_header(bp));
+    size_t index;
+
+    if (size > adjust_size(SLAB_MAX))
+        return;
+    /* the smallest request it serves is 16 bytes less than the largest */
+    index = size == MINI_BLOCK ? 0 : (size - DSIZE - WSIZE) / ALIGNMENT;
+    if (index >= SLAB_CLASSES)
+        index = SLAB_CLASSES - 1;
+    __atomic_fetch_add(&arena_of(bp)->small_live[index], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Return the slab that holds ptr, or NULL if ptr is not in a slab.
+ * Other arenas mark their pages in the same word, so it is read
+ * atomically.
+ */
+static slab_t *slab_of(const void *ptr) {
+    unsigned long page = ((unsigned long) ptr >> LOG2_SLAB_SIZE) -
+                         ((unsigned long) mem_heap_lo() >> LOG2_SLAB_SIZE);
+
+    if (page >= SLAB_PAGES)
+        return NULL;
+    if (!((__atomic_load_n(&slab_pages[page / 64], __ATOMIC_RELAXED) >> (page % 64)) & 1))
+        return NULL;
+    return (slab_t *) ((unsigned long) ptr & ~(SLAB_SIZE - 1UL));
 }
 
-/* Given block ptr bp, compute address of next and previous blocks */
-static char *next_block(void *bp) {
-    return (char *) (bp) + get_size(((char *) (bp) - WSIZE));
-}
+/* Set or clear the slab_pages bit of page, which other arenas share */
+static void slab_mark(const void *page, bool on) {
+    unsigned long n = ((unsigned long) page >> LOG2_SLAB_SIZE) -
+                      ((unsigned long) mem_heap_lo() >> LOG2_SLAB_SIZE);
 
-static char *prev_block(void *bp) {
-    return (char *) (bp) - get_size(((char *) (bp) - DSIZE));
+    if (on)
+        __atomic_fetch_or(&slab_pages[n / 64], 1UL << (n % 64), __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&slab_pages[n / 64], ~(1UL << (n % 64)), __ATOMIC_RELAXED);
 }
 
-static unsigned int next_free_block(void *bp) {
-    return *(unsigned int *) ((char *) (bp) + WSIZE);
+/*
+ * slab_block - allocate a heap block of SLAB_SIZE bytes whose payload
+ * starts on a page boundary covered by slab_pages. The free space in
+ * front of the page stays a free block. Return NULL if there is none.
+ */
+static void *slab_block(void) {
+    char *bp, *page, *end;
+    size_t csize, front, prev_bits;
+    unsigned long limit = ((unsigned long) mem_heap_lo() & ~(SLAB_SIZE - 1UL)) +
+                          (unsigned long) SLAB_PAGES * SLAB_SIZE;
+
+    /* a free block of twice the size always holds an aligned page */
+    if ((bp = find_fit(SLAB_SIZE)) != NULL &&
+        ((unsigned long) bp + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE + SLAB_SIZE >
+        (unsigned long) bp + get_size(get_header(bp)))
+        bp = find_fit(2 * SLAB_SIZE);
+    if (bp == NULL) {
+        /* extend the heap just past the next page boundary */
+        pthread_mutex_lock(&brk_lock);
+        end = (char *) mem_heap_hi() + 1;
+        /* a new chunk starts after its marker and first header */
+        if (top_arena != (int) arena->id)
+            end += DSIZE;
+        pthread_mutex_unlock(&brk_lock);
+        front = -(unsigned long) end & (SLAB_SIZE - 1);
+        if ((unsigned long) end + front + SLAB_SIZE > limit)
+            return NULL;
+        if ((bp = extend_heap((front + SLAB_SIZE) / WSIZE)) == NULL)
+            return NULL;
+    }
+    page = (char *) (((unsigned long) bp + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1UL));
+    /* another arena may have grown the heap first, then the page is lost */
+    if ((unsigned long) page + SLAB_SIZE > limit ||
+        page + SLAB_SIZE > bp + get_size(get_header(bp)))
+        return NULL;
+    front = page - bp;
+    if (front > 0) {
+        /* split the space before the page off as a free block */
+        if (STATS)
+            arena->stats.splits++;
+        delete_free_block(bp);
+        csize = get_size(get_header(bp));
+        prev_bits = get_prev_bits(get_header(bp));
+        put(get_header(bp), pack(front, prev_bits));
+        if (front > MINI_BLOCK)
+            put(get_footer(bp), pack(front, prev_bits));
+        put(get_header(page), pack(csize - front, front == MINI_BLOCK ? PREV_MINI : 0));
+        put(get_footer(page), get(get_header(page)));
+        add_free_block(bp);
+        add_free_block(page);
+    }
+    place(page, SLAB_SIZE);
+    slab_mark(page, true);
+    return page;
 }
 
-static unsigned int prev_free_block(void *bp) {
-    return *(unsigned int *) (bp);
-}
+/* Push slab onto the list of its class */
+static void slab_link(slab_t *slab) {
+    slab_t **head = &arena->slab_lists[slab->size / ALIGNMENT - 1];
 
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL)
+        (*head)->prev = slab;
+    *head = slab;
+}
 
+static void slab_unlink(slab_t *slab) {
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        arena->slab_lists[slab->size / ALIGNMENT - 1] = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
 
 /*
- * Initialize: return -1 on error, 0 on success.
+ * map_malloc - map a region for a request of size bytes, with its
+ * length and arena in front of the payload. Takes brk_lock.
  */
+static void *map_malloc(size_t size) {
+    char *region;
 
-/* convert 4-byte integer to 8-byte address */
-static inline void *int_to_ptr(unsigned int n) {
-    return ((n) == 1U ? NULL : (void *) ((unsigned int) (n) + offset));
+    if (size > (size_t) -1 - MMAP_THRESHOLD)
+        return NULL;
+    pthread_mutex_lock(&brk_lock);
+    region = mem_map(size + DSIZE);
+    pthread_mutex_unlock(&brk_lock);
+    if (region == NULL)
+        return NULL;
+    *(size_t *) region = size + DSIZE;
+    *((size_t *) region + 1) = my_arena()->id;
+    return region + DSIZE;
 }
 
-/* conver 8-byte address to 4-byte integer */
-static inline unsigned int ptr_to_int(void *p) {
-    return ((p) == NULL ? 1U : (unsigned int) ((unsigned long) (p) - offset));
+/*
+ * map_free - unmap the region of ptr, counting the free in the arena
+ * that mapped it. Takes brk_lock.
+ */
+static void map_free(void *ptr) {
+    char *region = (char *) ptr - DSIZE;
+
+    count_ops(arenas[*((size_t *) region + 1)].stats.frees, *(size_t *) region, 1);
+    pthread_mutex_lock(&brk_lock);
+    mem_unmap(region, *(size_t *) region);
+    pthread_mutex_unlock(&brk_lock);
 }
 
-bool mm_init(void) {
-    /* Create the initial empty heap */
-//    dbg_printf("mm_init");
-    if ((heap_listp = mem_sbrk((4 + NUMBER) * WSIZE)) == (void *) -1) {
-        printf("initial failed");
-        return false;
-    }
-    offset = (unsigned long) heap_listp;
-    offset &= 0xffffffff00000000UL;
-    /* Alignment */
-    put(heap_listp + NUMBER * WSIZE, 0);
-    /* Prologue header */
-    put(heap_listp + NUMBER * WSIZE + WSIZE, pack(DSIZE, 1));
-    /* Prologue footer */
-    put(heap_listp + (2 * WSIZE) + NUMBER * WSIZE, pack(DSIZE, 1));
-    /* Epilogue header */
-    put(heap_listp + (3 * WSIZE) + NUMBER * WSIZE, pack(0, 1));
+/*
+ * map_realloc - resize the region of ptr to hold size bytes, moving
+ * its pages if it cannot grow in place. Return NULL if there is no
+ * room, and leave the region as it was. Takes brk_lock.
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    char *region = (char *) ptr - DSIZE;
+    size_t oldsize = *(size_t *) region;
 
-    for (int i = 0; i < NUMBER; i++)
-        put(heap_listp + WSIZE * i, 1U);
-    heap_listp += (NUMBER + 2) * WSIZE;
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
-        return false;
-    return true;
+    if (size > (size_t) -1 - MMAP_THRESHOLD)
+        return NULL;
+    pthread_mutex_lock(&brk_lock);
+    region = mem_remap(region, oldsize, size + DSIZE);
+    pthread_mutex_unlock(&brk_lock);
+    if (region == NULL)
+        return NULL;
+    *(size_t *) region = size + DSIZE;
+    /* the region counts as freed at its old length, mapped at its new */
+    count_ops(arenas[*((size_t *) region + 1)].stats.frees, oldsize, 1);
+    count_ops(arenas[*((size_t *) region + 1)].stats.mallocs, size + DSIZE, 1);
+    return region + DSIZE;
 }
 
 /*
- * malloc
+ * Mapped regions lie above the brk heap, which never grows past them.
+ * Takes no lock: a live block stays on its side of any break the read
+ * may see, and memlib reads the break atomically.
  */
-void *malloc(size_t size) {
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;
+static bool is_mapped(const void *ptr) {
+    return ptr > mem_heap_hi();
+}
 
-//    dbg_printf("malloc(%zd)\n", size);
+/*
+ * count_ops - count n malloc or free calls for blocks of asize bytes.
+ * The thread cache takes no lock, so the counts are atomic.
+ */
+static void count_ops(unsigned long *counts, size_t asize, size_t n) {
+    if (STATS)
+        __atomic_fetch_add(&counts[get_block_size(asize)], n, __ATOMIC_RELAXED);
+}
 
-    if (heap_listp == 0) {
-        mm_init();
-    }
-    /* Ignore spurious requests */
-    if (size == 0)
-        return NULL;
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
+/*
+ * count_ptr - count a malloc or free of ptr in counts, by the size of
+ * the block, slab slot or mapped region that holds it, so that the
+ * malloc and the free of a block land in the same class. Return ptr.
+ */
+static void *count_ptr(unsigned long *counts, void *ptr) {
+    slab_t *slab;
+
+    if (!STATS || ptr == NULL)
+        return ptr;
+    if (is_mapped(ptr))
+        count_ops(counts, *(size_t *) ((char *) ptr - DSIZE), 1);
+    else if ((slab = slab_of(ptr)) != NULL)
+        count_ops(counts, adjust_size(slab->size), 1);
     else
-        asize = align((size) + (DSIZE));
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
-        return bp;
+        count_ops(counts, get_size(get_header(ptr)), 1);
+    return ptr;
+}
+
+/* Count a find_fit search that looked at probes blocks, and return bp */
+static void *count_fit(void *bp, unsigned long probes) {
+    if (STATS) {
+        arena->stats.fit_calls++;
+        arena->stats.fit_probes += probes;
+        if (probes > arena->stats.fit_probes_max)
+            arena->stats.fit_probes_max = probes;
     }
-    /* No fit found. Get more memory and place the block */
-    extendsize = max(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
-        return NULL;
-    place(bp, asize);
     return bp;
 }
 
 /*
- * free
+ * mm_stats - add up the counters of the arenas since the last mm_init
+ * into out, and the free blocks of each class as the heap is now.
+ * Blocks in the thread caches and on the quick lists count as
+ * allocated. Return false if mm.c was built without MM_STATS.
  */
-void free(void *ptr) {
-    if (ptr == 0)
-        return;
-    size_t size = get_size(get_header(ptr));
-    if (heap_listp == 0) {
-        mm_init();
+bool mm_stats(mm_stats_t *out) {
+    mm_stats_t *s;
+    char *bp, *chunk;
+    size_t size;
+    int index;
+
+    if (!STATS)
+        return false;
+    memset(out, 0, sizeof(*out));
+    if (heap_listp == 0)
+        return true;
+    for (int i = 0; i < ARENAS; i++) {
+        arena_lock(&arenas[i]);
+        s = &arena->stats;
+        for (index = 0; index < MM_STATS_CLASSES; index++) {
+            out->mallocs[index] += s->mallocs[index];
+            out->frees[index] += s->frees[index];
+        }
+        out->fit_calls += s->fit_calls;
+        out->fit_probes += s->fit_probes;
+        out->fit_probes_max = max(out->fit_probes_max, s->fit_probes_max);
+        out->splits += s->splits;
+        out->coalesces += s->coalesces;
+        out->extends += s->extends;
+        out->extend_bytes += s->extend_bytes;
+        for (chunk = arena->chunk; chunk != NULL; chunk = *(char **) chunk) {
+            for (bp = chunk + DSIZE; (size = get_size(get_header(bp))) > 0; bp = next_block(bp)) {
+                if (get_alloc(get_header(bp)))
+                    continue;
+                index = get_block_size(size);
+                out->free_bytes[index] += size;
+                out->free_blocks[index]++;
+            }
+        }
+        pthread_mutex_unlock(&arena->lock);
     }
-    put(get_header(ptr), pack(size, 0));
-    put(get_footer(ptr), pack(size, 0));
-    coalesce(ptr);
+    pthread_mutex_lock(&brk_lock);
+    out->heap_bytes = mem_heapsize();
+    pthread_mutex_unlock(&brk_lock);
+    return true;
 }
 
 static void *coalesce(void *bp) {
-    size_t prev_alloc = get_alloc(get_footer(prev_block(bp)));
+    size_t prev_alloc = get_prev_alloc(get_header(bp));
     size_t next_alloc = get_alloc(get_header(next_block(bp)));
     size_t size = get_size(get_header(bp));
+
+    untouch_block(bp);
+    if (!next_alloc)
+        untouch_block(next_block(bp));
     if (prev_alloc && next_alloc) { /* Case 1 */
     } else if (prev_alloc && !next_alloc) {      /* Case 2 */
-
+        if (STATS)
+            arena->stats.coalesces++;
         delete_free_block(next_block(bp));
         size += get_size(get_header(next_block(bp)));
-        put(get_header(bp), pack(size, 0));
-        put(get_footer(bp), pack(size, 0));
     } else if (!prev_alloc && next_alloc) {      /* Case 3 */
+        if (STATS)
+            arena->stats.coalesces++;
         delete_free_block(prev_block(bp));
         size += get_size(get_header(prev_block(bp)));
-        put(get_footer(bp), pack(size, 0));
-        put(get_header(prev_block(bp)), pack(size, 0));
         bp = prev_block(bp);
-
     } else {                                     /* Case 4 */
+        if (STATS)
+            arena->stats.coalesces += 2;
         delete_free_block(prev_block(bp));
         delete_free_block(next_block(bp));
         size += get_size(get_header(prev_block(bp))) +
-                get_size(get_footer(next_block(bp)));
-        put(get_header(prev_block(bp)), pack(size, 0));
-        put(get_footer(next_block(bp)), pack(size, 0));
+                get_size(get_header(next_block(bp)));
         bp = prev_block(bp);
     }
+    /* the block before a coalesced free block is always allocated */
+    put(get_header(bp), pack(size, get_prev_bits(get_header(bp))));
+    if (size > MINI_BLOCK)
+        put(get_footer(bp), get(get_header(bp)));
+    set_next_prev(bp);
     add_free_block(bp);
+    touch_block(bp);
     return bp;
 }
 
+/*
+ * trim_heap - if free block bp is the last block of the heap and holds
+ * at least TRIM_THRESHOLD bytes, give all but TRIM_PAD of them back to
+ * memlib. Only the chunk at the top of the brk heap can shrink.
+ */
+static void trim_heap(void *bp) {
+    size_t size = get_size(get_header(bp));
+
+    if (size < TRIM_THRESHOLD || get_size(get_header(next_block(bp))) != 0)
+        return;
+    pthread_mutex_lock(&brk_lock);
+    if (next_block(bp) == (char *) mem_heap_hi() + 1) {
+        delete_free_block(bp);
+        put(get_header(bp), pack(TRIM_PAD, get_prev_bits(get_header(bp))));
+        put(get_footer(bp), get(get_header(bp)));
+        put(get_header(next_block(bp)), pack(0, 1));   /* New epilogue header */
+        set_next_prev(bp);
+        add_free_block(bp);
+        mem_sbrk(-(intptr_t) (size - TRIM_PAD));
+    }
+    pthread_mutex_unlock(&brk_lock);
+}
+
 /*
  * realloc - you may want to look at mm-naive.c
  */
 void *realloc(void *oldptr, size_t size) {
-    size_t oldsize;
+    size_t oldsize, asize;
     void *newptr;
+    slab_t *slab;
+    bool done;         /* resized under the lock, without malloc and free */
     /* If size == 0 then this is just free, and we return NULL. */
     if (size == 0) {
         free(oldptr);
@@ -310,16 +1735,63 @@ void *realloc(void *oldptr, size_t size) {
     if (oldptr == NULL) {
         return malloc(size);
     }
-    if (size <= DSIZE)
-        size = 2 * DSIZE;
-    else
-        size = align((size) + (DSIZE));
+    /* A mapped block keeps its region while it is big enough */
+    if (is_mapped(oldptr)) {
+        if (size >= MMAP_THRESHOLD)
+            return map_realloc(oldptr, size);
+        if ((newptr = malloc(size)) == NULL)
+            return 0;
+        memcpy(newptr, oldptr, size);
+        free(oldptr);
+        return newptr;
+    }
+    /* A slab object keeps its slot while it fits, otherwise it moves */
+    if ((slab = slab_of(oldptr)) != NULL) {
+        if (size <= slab->size)
+            return oldptr;
+        if ((newptr = malloc(size)) == NULL)
+            return 0;
+        memcpy(newptr, oldptr, slab->size);
+        free(oldptr);
+        return newptr;
+    }
+    asize = adjust_size(size);
     oldsize = get_size(get_header(oldptr));
 
     /* If oldsize is equal to size, return oldptr */
-    if (size == oldsize)
+    if (asize == oldsize)
         return oldptr;
 
+    /* Shrink, or grow into the next block if it is free */
+    arena_lock(arena_of(oldptr));
+    count_small(oldptr, -1);
+    if (asize >= oldsize) {
+        /* a block that reaches MMAP_THRESHOLD moves to a region */
+        done = size < MMAP_THRESHOLD && grow_block(oldptr, asize);
+        newptr = oldptr;
+    } else if (asize < oldsize / 2 && (newptr = find_fit(asize)) != NULL) {
+        /* a block that shrinks to less than half moves into a free
+           block that fits, leaving the big one whole for reuse */
+        place(newptr, asize);
+        memcpy(newptr, oldptr, size);
+        heap_free(oldptr);
+        done = true;
+    } else {
+        shrink_block(oldptr, asize);
+        done = true;
+        newptr = oldptr;
+    }
+    /* malloc and free count the block if it goes through them */
+    count_small(done ? newptr : oldptr, 1);
+    if (STATS && done) {
+        /* a resized block counts as freed at its old size, allocated at its new */
+        count_ops(arena->stats.frees, oldsize, 1);
+        count_ptr(arena->stats.mallocs, newptr);
+    }
+    arena_unlock();
+    if (done)
+        return newptr;
+
     newptr = malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
@@ -327,7 +1799,8 @@ void *realloc(void *oldptr, size_t size) {
         return 0;
     }
 
-    /* Copy the old data. */
+    /* Copy the old data, the payload ends at the next header. */
+    oldsize -= WSIZE;
     if (size < oldsize) oldsize = size;
     memcpy(newptr, oldptr, oldsize);
 
@@ -373,57 +1846,183 @@ static int aligned(const void *p) {
  * mm_checkheap
  */
 bool mm_checkheap(int lineno) {
-    checkheap(1);
+    if (heap_listp == 0)
+        return true;
+    for (int i = 0; i < ARENAS; i++) {
+        arena_lock(&arenas[i]);
+        checkheap(1);
+        pthread_mutex_unlock(&arena->lock);
+    }
     return true;
 }
 
+/*
+ * extend_heap - add a free block of words words to the locked arena.
+ * If its last chunk is at the top of the brk heap the chunk grows,
+ * otherwise a new chunk starts there.
+ */
 static void *extend_heap(size_t words) {
     char *bp;
-    size_t size;
+    size_t size, prev_bits;
+    bool grow;
 //    dbg_printf("extend_heap(%zd)\n", words);
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
 
-    if ((long) (bp = mem_sbrk(size)) == -1)
+    pthread_mutex_lock(&brk_lock);
+    grow = top_arena == (int) arena->id;
+    /* a new chunk also needs its marker and epilogue */
+    if ((long) (bp = mem_sbrk(grow ? size : size + DSIZE)) != -1)
+        top_arena = arena->id;
+    pthread_mutex_unlock(&brk_lock);
+    if ((long) bp == -1)
         return NULL;
-    put(get_header(bp), pack(size, 0));    /* Free block header */
-    put(get_footer(bp), pack(size, 0));    /* Free block footer */
+    if (!arena->wide_links && bp + size + DSIZE - link_base > (long) LINK_REACH)
+        widen_links();
+    if (STATS) {
+        arena->stats.extends++;
+        arena->stats.extend_bytes += size;
+    }
+    if (grow) {
+        /* The old epilogue describes the last block */
+        prev_bits = get_prev_bits(get_header(bp));
+    } else {
+        /* The marker links the chunks of the arena */
+        *(char **) bp = arena->chunk;
+        arena->chunk = bp;
+        bp += DSIZE;
+        prev_bits = PREV_ALLOC;
+    }
+    put(get_header(bp), pack(size, prev_bits));    /* Free block header */
+    put(get_footer(bp), pack(size, prev_bits));    /* Free block footer */
     put(get_header(next_block(bp)), pack(0, 1));   /* New epilogue header */
     /* Coalesce if the previous block was free */
     return coalesce(bp);
 }
 
+/*
+ * widen_links - rewrite the list heads, the treap root and the links
+ * of every free block of the arena as full pointers, before it grows
+ * out of the reach of compact links. Called before the new space is
+ * linked.
+ */
+static void widen_links(void) {
+    char *bp, *chunk;
+
+    for (int i = 0; i < NUMBER; i++)
+        widen_link(list_head(i));
+    widen_link(&arena->tree_root);
+    for (chunk = arena->chunk; chunk != NULL; chunk = *(char **) chunk) {
+        for (bp = chunk + DSIZE; get_size(get_header(bp)) > 0; bp = next_block(bp)) {
+            if (get_alloc(get_header(bp)))
+                continue;
+            widen_link(bp);
+            /* a mini block has no second link */
+            if (get_size(get_header(bp)) > MINI_BLOCK)
+                widen_link(bp + WSIZE);
+        }
+    }
+    arena->wide_links = true;
+}
+
+/* Rewrite the compact link in slot as a pointer, in its 8 bytes */
+static void widen_link(void *slot) {
+    void *p = int_to_ptr(*(unsigned int *) slot);
+
+    *(void **) slot = p;
+}
+
 static void place(void *bp, size_t asize) {
 //    dbg_printf("place(%p, %zd)\n", bp, asize);
+    touch_block(bp);
     delete_free_block(bp);
     size_t csize = get_size(get_header(bp));
-    if ((csize - asize) >= (2 * DSIZE)) {
-        put(get_header(bp), pack(asize, 1));
-        put(get_footer(bp), pack(asize, 1));
+    size_t prev_bits = get_prev_bits(get_header(bp));
+    if ((csize - asize) >= MINI_BLOCK) {
+        if (STATS)
+            arena->stats.splits++;
+        put(get_header(bp), pack(asize, prev_bits | 1));
+        prev_bits = asize == MINI_BLOCK ? PREV_ALLOC | PREV_MINI : PREV_ALLOC;
         bp = next_block(bp);
-        put(get_header(bp), pack(csize - asize, 0));
-        put(get_footer(bp), pack(csize - asize, 0));
+        put(get_header(bp), pack(csize - asize, prev_bits));
+        if (csize - asize > MINI_BLOCK)
+            put(get_footer(bp), pack(csize - asize, prev_bits));
+        set_next_prev(bp);
         add_free_block(bp);
     } else {
-        put(get_header(bp), pack(csize, 1));
-        put(get_footer(bp), pack(csize, 1));
+        put(get_header(bp), pack(csize, prev_bits | 1));
+        set_next_prev(bp);
     }
 }
 
-/* give a size find the minimum block list */
-static int get_block_size(size_t size) {
-    int ans = 0;
-    size_t bsize = 16; /* minimum block size */
-    while (ans != 7 && size > bsize) {
-        bsize += 8;
-        ans++;
+/*
+ * shrink_block - cut allocated block bp down to asize bytes and free
+ * the tail, if it is big enough to be a block of its own.
+ */
+static void shrink_block(void *bp, size_t asize) {
+    size_t csize = get_size(get_header(bp));
+    size_t prev_bits;
+    char *rest;
+
+    if (csize - asize < MINI_BLOCK)
+        return;
+    if (STATS)
+        arena->stats.splits++;
+    put(get_header(bp), pack(asize, get_prev_bits(get_header(bp)) | 1));
+    prev_bits = asize == MINI_BLOCK ? PREV_ALLOC | PREV_MINI : PREV_ALLOC;
+    rest = next_block(bp);
+    put(get_header(rest), pack(csize - asize, prev_bits));
+    /* the tail may merge with a free block after it */
+    trim_heap(coalesce(rest));
+}
+
+/*
+ * grow_block - grow allocated block bp to at least asize bytes by
+ * absorbing the free block after it, extending the heap first if bp
+ * is the last block. Return false if bp cannot grow in place.
+ */
+static bool grow_block(void *bp, size_t asize) {
+    size_t avail = get_size(get_header(bp));
+    char *next = next_block(bp);
+    char *last = next;
+
+    if (!get_alloc(get_header(next))) {
+        avail += get_size(get_header(next));
+        last = next_block(next);
     }
-    while (ans != NUMBER - 1 && size > bsize) {
-        bsize += 32;
-        ans++;
+    if (avail < asize) {
+        /* only a block at the end of the heap can ask for more */
+        if (get_size(get_header(last)) != 0)
+            return false;
+        if (extend_heap(max(asize - avail, 2 * DSIZE) / WSIZE) == NULL)
+            return false;
+        next = next_block(bp);
+        if (get_alloc(get_header(next)))
+            return false;
+        avail = get_size(get_header(bp)) + get_size(get_header(next));
+        /* the new space went to another chunk if this one is not on top */
+        if (avail < asize)
+            return false;
     }
-    return ans;
+    delete_free_block(next);
+    untouch_block(next);
+    touch_block(bp);
+    put(get_header(bp), pack(avail, get_prev_bits(get_header(bp)) | 1));
+    set_next_prev(bp);
+    shrink_block(bp, asize);
+    return true;
+}
+
+/* give a size find the minimum block list */
+static int get_block_size(size_t size) {
+    int index;
+
+    if (size <= SMALL_LIMIT)
+        return small_class[(size + ALIGNMENT - 1) / ALIGNMENT];
+    /* one list per power of two above SMALL_LIMIT */
+    index = SMALL_CLASSES + (63 - __builtin_clzl(size - 1)) - LOG2_SMALL_LIMIT;
+    return index < NUMBER ? index : NUMBER - 1;
 }
 
 /* best search for five candidates */
@@ -432,20 +2031,25 @@ static void *find_fit(size_t asize) {
 //    dbg_printf("heap_listp = %p\n", heap_listp);
 
     int index = get_block_size(asize);
-    void *bp, *tmp;
+    /* non-empty lists from index upwards */
+    unsigned long lists = arena->free_lists_map & (~0UL << index);
+    void *bp, *tmp = NULL;
     size_t size = (1U) << 31;
     int c = 0;
-    while (index < NUMBER) {
-        for (bp = int_to_ptr(0U) + index * WSIZE; bp != NULL; bp = int_to_ptr(*(unsigned int *) ((char *) (bp)))) {
+    unsigned long probes = 0;   /* free blocks looked at */
+    while (lists != 0) {
+        index = __builtin_ctzl(lists);
+        for (bp = get_link(list_head(index)); bp != NULL; bp = next_free_block(bp)) {
+            probes++;
 //            dbg_printf("[1] bp = %p\n", bp);
 //            dbg_printf("get_size = %zd\n", get_size(get_header(bp)));
 //            if (bp < (void *)heap_listp)
 //                break;
-            if ((bp != int_to_ptr(0U) + index * WSIZE) && (asize == get_size(get_header(bp)))) {
-                return bp;
+            if (asize == get_size(get_header(bp))) {
+                return count_fit(bp, probes);
             }
 //            dbg_printf("[2] bp = %p\n", bp);
-            if ((bp != int_to_ptr(0U) + index * WSIZE) && (asize < get_size(get_header(bp)))) {
+            if (asize < get_size(get_header(bp))) {
                 if (asize < size) {
                     tmp = bp;
                     size = asize;
@@ -454,56 +2058,203 @@ static void *find_fit(size_t asize) {
                 }
                 c++;
                 if (c == 5)
-                    return tmp;
+                    return count_fit(tmp, probes);
             }
         }
         if (size != (1U << 31)) {
-            return tmp;
+            return count_fit(tmp, probes);
         }
-        index++;
+        lists &= lists - 1;
     }
-    return NULL; /* No fit */
+    /* No fit on the lists, take the best fit from the treap */
+    bp = tree_fit(asize, &probes);
+    return count_fit(bp, probes);
+}
 
+/* The head of list index of the arena, a link to its first block */
+static void *list_head(int index) {
+    return &arena->heads[index];
 }
 
 static void add_free_block(void *bp) {
 //    dbg_printf("add_free_block(%p)\n", bp);
     int index = get_block_size(get_size(get_header(bp)));
+    void *head = list_head(index);
+    void *first;
 
-    void *head = int_to_ptr(0U) + WSIZE * index;
-    if (get(head) == 1U) {
-        // if the free block is empty
-        (*(unsigned int *) (head)) = ptr_to_int(bp);
-        (*(unsigned int *) (bp)) = ptr_to_int(NULL);
-        (*(unsigned int *) ((char *) (bp) + 8)) = ptr_to_int(head);
-    } else {
-        (*(unsigned int *) (bp)) = (*(unsigned int *) (head));
-        (*(unsigned int *) ((char *) (int_to_ptr((*(unsigned int *) (bp)))) + 8)) = ptr_to_int(bp);
-        (*(unsigned int *) (head)) = ptr_to_int(bp);
-        (*(unsigned int *) ((char *) (bp) + 8)) = ptr_to_int(head);
+    if (index >= TREE_CLASS) {
+        tree_insert(&arena->tree_root, bp);
+        return;
     }
+    first = get_link(head);
+    set_link(bp, first);
+    /* mini blocks only have room for a compact predecessor */
+    if (index != MINI_CLASS) {
+        set_link((char *) (bp) + WSIZE, NULL);
+        if (first != NULL)
+            set_link((char *) (first) + WSIZE, bp);
+    } else if (!arena->wide_links) {
+        set_prev_mini(bp, NULL);
+        if (first != NULL)
+            set_prev_mini(first, bp);
+    }
+    set_link(head, bp);
+    arena->free_lists_map |= 1UL << index;
 }
 
 static void delete_free_block(void *bp) {
 //    dbg_printf("delete_free_block(%p)\n", bp);
-//    unsigned int *pp1 = (unsigned int *) ((char *) (int_to_ptr((*(unsigned int *) (bp)))) + 8);
-//    unsigned int *pp2 = (unsigned int *) (int_to_ptr((*(unsigned int *) ((char *) (bp) + 8))));
-//    dbg_printf("pp1 = %p, *pp1 = %x\n", pp1, *pp1);
-//    dbg_printf("pp2 = %p, *pp2 = %x\n", pp2, *pp2);
-    if ((*(unsigned int *) (bp)) != 1U) // not the last block
-    {
-//        dbg_printf("delete_free_block[1]");
-        (*(unsigned int *) ((char *) (int_to_ptr((*(unsigned int *) (bp)))) + 8)) = (*(unsigned int *) ((char *) (bp) +
-                                                                                                        8));
-//        dbg_printf("delete_free_block[2]");
-        (*(unsigned int *) (int_to_ptr((*(unsigned int *) ((char *) (bp) + 8))))) = (*(unsigned int *) (bp));
-//        dbg_printf("delete_free_block[3]");
+    int index = get_block_size(get_size(get_header(bp)));
+    void *next, *prev;
+
+    if (get_size(get_header(bp)) == MINI_BLOCK) {
+        delete_mini_block(bp);
+        return;
+    }
+    if (index >= TREE_CLASS) {
+        tree_delete(bp);
+        return;
+    }
+    next = next_free_block(bp);
+    prev = prev_free_block(bp);
+    if (next != NULL)
+        set_link((char *) (next) + WSIZE, prev);
+    if (prev != NULL) {
+        set_link(prev, next);
+    } else {
+        /* bp was the first block, so the head takes its successor */
+        set_link(list_head(index), next);
+        if (next == NULL)
+            arena->free_lists_map &= ~(1UL << index);
+    }
+}
+
+/*
+ * Unlink mini block bp through its predecessor link. With wide links
+ * the list is singly linked and the predecessor is found by a walk, a
+ * cost only heaps beyond LINK_REACH pay.
+ */
+static void delete_mini_block(void *bp) {
+    void *next = get_link(bp);
+    void *p = list_head(MINI_CLASS);
+
+    if (arena->wide_links) {
+        while (get_link(p) != bp)
+            p = get_link(p);
+    } else {
+        if (next != NULL)
+            set_prev_mini(next, prev_mini_block(bp));
+        if (prev_mini_block(bp) != NULL)
+            p = prev_mini_block(bp);
+    }
+    set_link(p, next);
+    if (get_link(list_head(MINI_CLASS)) == NULL)
+        arena->free_lists_map &= ~(1UL << MINI_CLASS);
+}
+
+/* The treap links of a free block, in the successor and predecessor slots */
+static void *tree_left(void *bp) {
+    return bp;
+}
+
+static void *tree_right(void *bp) {
+    return (char *) (bp) + WSIZE;
+}
+
+/* Order blocks by size, then by address */
+static bool tree_less(void *a, void *b) {
+    size_t asize = get_size(get_header(a));
+    size_t bsize = get_size(get_header(b));
+
+    return asize < bsize || (asize == bsize && a < b);
+}
+
+/* A multiplicative hash of the address keeps the treap balanced */
+static unsigned int tree_priority(void *bp) {
+    return (unsigned int) (((unsigned long) bp >> 4) * 2654435761UL >> 16);
+}
+
+/* Insert bp into the subtree at link, rotating it up by priority */
+static void tree_insert(void *link, void *bp) {
+    void *node = get_link(link);
+    void *child;
+
+    if (node == NULL) {
+        set_link(tree_left(bp), NULL);
+        set_link(tree_right(bp), NULL);
+        set_link(link, bp);
+        return;
+    }
+    if (tree_less(bp, node)) {
+        tree_insert(tree_left(node), bp);
+        child = get_link(tree_left(node));
+        if (tree_priority(child) > tree_priority(node)) {
+            set_link(tree_left(node), get_link(tree_right(child)));
+            set_link(tree_right(child), node);
+            set_link(link, child);
+        }
     } else {
-//        dbg_printf("delete_free_block[4]");
-        (*(unsigned int *) (int_to_ptr((*(unsigned int *) ((char *) (bp) + 8))))) = 1U;
-//        dbg_printf("delete_free_block[5]");
+        tree_insert(tree_right(node), bp);
+        child = get_link(tree_right(node));
+        if (tree_priority(child) > tree_priority(node)) {
+            set_link(tree_right(node), get_link(tree_left(child)));
+            set_link(tree_left(child), node);
+            set_link(link, child);
+        }
+    }
+}
+
+/* Rotate bp down until it has at most one child, then unlink it */
+static void tree_delete(void *bp) {
+    void *link = &arena->tree_root;
+    void *node, *left, *right;
+
+    while ((node = get_link(link)) != bp)
+        link = tree_less(bp, node) ? tree_left(node) : tree_right(node);
+    for (;;) {
+        left = get_link(tree_left(bp));
+        right = get_link(tree_right(bp));
+        if (left == NULL) {
+            set_link(link, right);
+            return;
+        }
+        if (right == NULL) {
+            set_link(link, left);
+            return;
+        }
+        /* the child with the higher priority takes bp's place */
+        if (tree_priority(left) > tree_priority(right)) {
+            set_link(tree_left(bp), get_link(tree_right(left)));
+            set_link(tree_right(left), bp);
+            set_link(link, left);
+            link = tree_right(left);
+        } else {
+            set_link(tree_right(bp), get_link(tree_left(right)));
+            set_link(tree_left(right), bp);
+            set_link(link, right);
+            link = tree_left(right);
+        }
     }
+}
 
+/*
+ * tree_fit - return the smallest, then lowest, block of at least asize
+ * bytes, adding the nodes visited to probes.
+ */
+static void *tree_fit(size_t asize, unsigned long *probes) {
+    void *node = get_link(&arena->tree_root);
+    void *best = NULL;
+
+    while (node != NULL) {
+        (*probes)++;
+        if (get_size(get_header(node)) >= asize) {
+            best = node;
+            node = get_link(tree_left(node));
+        } else {
+            node = get_link(tree_right(node));
+        }
+    }
+    return best;
 }
 
 static void printblock(void *bp) {
@@ -512,13 +2263,17 @@ static void printblock(void *bp) {
     checkheap(0);
     hsize = get_size(get_header(bp));
     halloc = get_alloc(get_header(bp));
-    fsize = get_size(get_footer(bp));
-    falloc = get_alloc(get_footer(bp));
 
     if (hsize == 0) {
         printf("%p: EOL\n", bp);
         return;
     }
+    if (halloc || hsize == MINI_BLOCK) {
+        printf("%p: header: [%ld:%c]\n", bp, hsize, (halloc ? 'a' : 'f'));
+        return;
+    }
+    fsize = get_size(get_footer(bp));
+    falloc = get_alloc(get_footer(bp));
 
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
            hsize, (halloc ? 'a' : 'f'),
@@ -534,10 +2289,23 @@ static void checkblock(void *bp) {
         printf("Error: %p is not in heap \n", bp);
         exit(0);
     }
-    if (get(get_header(bp)) != get(get_footer(bp))) {
+    if (arena_of(bp) != arena) {
+        printf("Error: %p is not in arena %u\n", bp, arena->id);
+        exit(0);
+    }
+    if (!get_alloc(get_header(bp)) && get_size(get_header(bp)) > MINI_BLOCK &&
+        get(get_header(bp)) != get(get_footer(bp))) {
         printf("Error: header does not match footer\n");
         exit(0);
     }
+    if (!get_prev_alloc(get_header(next_block(bp))) != !get_alloc(get_header(bp))) {
+        printf("Error: prev-alloc bit of %p is wrong\n", next_block(bp));
+        exit(0);
+    }
+    if (!(get(get_header(next_block(bp))) & PREV_MINI) != (get_size(get_header(bp)) != MINI_BLOCK)) {
+        printf("Error: prev-mini bit of %p is wrong\n", next_block(bp));
+        exit(0);
+    }
 }
 
 /* Check coalescing: no two consecutive free blocks in the heap. */
@@ -550,62 +2318,214 @@ static void checkcoalescing(void *bp) {
     }
 }
 
-/* check the free list */
+/* check a block on free list index and its links */
 static void checkfreelist(void *bp, int index) {
-    /* head only have next pointer */
-    if (bp == int_to_ptr(0U) + index * WSIZE) {
-        /* address exceeds heap boundary */
-        if (((*(unsigned int *) (bp)) != 1U) && !in_heap(int_to_ptr((*(unsigned int *) (bp))))) {
-            printf("Error: block pointer exceeds heap boundary\n");
+    void *next = next_free_block(bp);
+
+    if (!in_heap(bp) || get_alloc(get_header(bp)) ||
+        get_block_size(get_size(get_header(bp))) != index) {
+        printf("Error: %p is misplaced in free list %d\n", bp, index);
+        exit(0);
+    }
+    /* address exceeds heap boundary */
+    if (next != NULL && !in_heap(next)) {
+        printf("Error: block pointer exceeds heap boundary\n");
+        exit(0);
+    }
+    /* the mini list has compact predecessor links, or none */
+    if (index == MINI_CLASS) {
+        if (!arena->wide_links &&
+            ((prev_mini_block(bp) == NULL) != (get_link(list_head(index)) == bp) ||
+             (next != NULL && prev_mini_block(next) != bp))) {
+            printf("Error: predecessor links of mini block %p are not consistent\n", bp);
             exit(0);
         }
-    } else {
-        if ((*(unsigned int *) (bp)) != 1U) {
-            if (!in_heap(int_to_ptr((*(unsigned int *) (bp))))) {
-                printf("Error: block pointer exceeds heap boundary ");
+        return;
+    }
+    if ((prev_free_block(bp) == NULL) != (get_link(list_head(index)) == bp)) {
+        printf("Error: only the first block of list %d has no predecessor\n", index);
+        exit(0);
+    }
+    if (next != NULL && prev_free_block(next) != bp) {
+        printf("Error: next and previous pointers are not consistent\n");
+        exit(0);
+    }
+}
+
+/* check a slab: its block, its page bit and its object count */
+static void checkslab(slab_t *slab) {
+    unsigned int n = 0;
+
+    if (get_size(get_header(slab)) != SLAB_SIZE || !get_alloc(get_header(slab))) {
+        printf("Error: slab %p is not an allocated block of a page\n", slab);
+        exit(0);
+    }
+    if (slab_of((char *) slab + SLAB_HEADER) != slab) {
+        printf("Error: slab %p is not marked in slab_pages\n", slab);
+        exit(0);
+    }
+    for (int i = 0; i < SLAB_MAP_WORDS; i++)
+        n += __builtin_popcountl(slab->free_map[i]);
+    if (slab->count == 0 || slab->count + n != SLAB_ROOM / slab->size) {
+        printf("Error: slab %p counts %u objects\n", slab, slab->count);
+        exit(0);
+    }
+}
+
+/* check the treap below bp: free large blocks in order between lo and hi */
+static void checktree(void *bp, void *lo, void *hi) {
+    if (bp == NULL)
+        return;
+    if (!in_heap(bp) || get_alloc(get_header(bp)) ||
+        get_block_size(get_size(get_header(bp))) < TREE_CLASS) {
+        printf("Error: %p does not belong in the treap\n", bp);
+        exit(0);
+    }
+    if ((lo != NULL && !tree_less(lo, bp)) || (hi != NULL && !tree_less(bp, hi))) {
+        printf("Error: treap node %p is out of order\n", bp);
+        exit(0);
+    }
+    if ((lo != NULL && get_link(tree_right(lo)) == bp && tree_priority(bp) > tree_priority(lo)) ||
+        (hi != NULL && get_link(tree_left(hi)) == bp && tree_priority(bp) > tree_priority(hi))) {
+        printf("Error: treap node %p outranks its parent\n", bp);
+        exit(0);
+    }
+    checktree(get_link(tree_left(bp)), lo, bp);
+    checktree(get_link(tree_right(bp)), bp, hi);
+}
+
+/*
+ * checklocal - check block bp and its neighbours, and the links of bp
+ * if it is free, without walking the heap.
+ */
+static void checklocal(void *bp) {
+    char *next = next_block(bp);
+    char *prev;
+
+    checkblock(bp);
+    if (!get_prev_alloc(get_header(bp))) {
+        prev = prev_block(bp);
+        if (!in_heap(prev) || next_block(prev) != bp) {
+            printf("Error: the block before %p does not end at it\n", bp);
+            exit(0);
+        }
+        checkblock(prev);
+        checkcoalescing(prev);
+    }
+    if (get_size(get_header(next)) > 0) {
+        checkcoalescing(bp);
+        checkblock(next);
+    }
+    if (!get_alloc(get_header(bp)))
+        checklinks(bp);
+}
+
+/*
+ * checklinks - check that free block bp is linked into the list or the
+ * treap of its class, looking at its neighbours on the list or at the
+ * path to it in the treap.
+ */
+static void checklinks(void *bp) {
+    int index = get_block_size(get_size(get_header(bp)));
+    void *node, *prev;
+
+    if (!((arena->free_lists_map >> index) & 1) && index < TREE_CLASS) {
+        printf("Error: list %d of free block %p is marked empty\n", index, bp);
+        exit(0);
+    }
+    if (index >= TREE_CLASS) {
+        for (node = get_link(&arena->tree_root); node != bp;
+             node = get_link(tree_less(bp, node) ? tree_left(node) : tree_right(node))) {
+            if (node == NULL) {
+                printf("Error: %p is not in the treap\n", bp);
                 exit(0);
             }
-            if ((*(unsigned int *) ((char *) (int_to_ptr((*(unsigned int *) (bp)))) + 8)) != ptr_to_int(bp)) {
-                printf("Error: next and previous pointers are not consistent");
+        }
+        for (int i = 0; i < 2; i++) {
+            node = get_link(i == 0 ? tree_left(bp) : tree_right(bp));
+            if (node != NULL && (tree_less(node, bp) != (i == 0) ||
+                                 tree_priority(node) > tree_priority(bp))) {
+                printf("Error: treap child %p of %p is misplaced\n", node, bp);
                 exit(0);
             }
         }
+        return;
+    }
+    checkfreelist(bp, index);
+    if (index == MINI_CLASS && arena->wide_links)
+        return;
+    /* checkfreelist has seen to a first block, so bp has a predecessor */
+    prev = index == MINI_CLASS ? prev_mini_block(bp) : prev_free_block(bp);
+    if (prev != NULL && (!in_heap(prev) || next_free_block(prev) != bp)) {
+        printf("Error: the predecessor of %p does not link to it\n", bp);
+        exit(0);
     }
 }
 
 /*
- * checkheap - Minimal check of the heap for consistency
+ * checkheap - Minimal check of the locked arena for consistency
  */
 void checkheap(int verbose) {
-     char *bp = heap_listp;
+     char *bp, *chunk;
      int index = 0;
 
      if (verbose)
-         printf("Heap (%p):\n", heap_listp);
+         printf("Arena %u (%p):\n", arena->id, arena->chunk);
 
-     if ((get_size(get_header(heap_listp)) != DSIZE) || !get_alloc(get_header(heap_listp))) {
-         printf("Bad prologue header %ld\n", get_size(get_header(heap_listp)));
-         exit(0);
+     for (chunk = arena->chunk; chunk != NULL; chunk = *(char **) chunk) {
+         if (!in_heap(chunk) || !get_prev_alloc(get_header(chunk + DSIZE))) {
+             printf("Bad chunk %p\n", chunk);
+             exit(0);
+         }
+         for (bp = chunk + DSIZE; get_size(get_header(bp)) > 0; bp = next_block(bp)) {
+             if (verbose)
+                 printblock(bp);
+             if (get_size(get_header(next_block(bp))) > 0)
+                 checkcoalescing(bp);
+             checkblock(bp);
+             if (get_alloc(get_header(bp)) && slab_of(bp) == (slab_t *) bp)
+                 checkslab((slab_t *) bp);
+         }
+         if (!get_alloc(get_header(bp))) {
+             printf("Bad epilogue header at %p\n", bp);
+             exit(0);
+         }
+     }
+     for (index = 0; index < SLAB_CLASSES; index++) {
+         for (slab_t *slab = arena->slab_lists[index]; slab != NULL; slab = slab->next) {
+             if (slab->size != (unsigned int) (index + 1) * ALIGNMENT ||
+                 slab->count == SLAB_ROOM / slab->size ||
+                 (slab->next != NULL && slab->next->prev != slab)) {
+                 printf("Error: slab %p is misplaced in list %d\n", slab, index);
+                 exit(0);
+             }
+         }
+     }
+     checktree(get_link(&arena->tree_root), NULL, NULL);
+     /* deferred blocks stay allocated and on the list of their size */
+     size_t quick = 0;
+     for (index = 0; index < QUICK_CLASSES; index++) {
+         for (bp = arena->quick_lists[index]; bp != NULL; bp = *(void **) bp) {
+             if (!get_alloc(get_header(bp)) ||
+                 get_block_size(get_size(get_header(bp))) != index) {
+                 printf("Error: %p is misplaced in quick list %d\n", bp, index);
+                 exit(0);
+             }
+             quick += get_size(get_header(bp));
+         }
      }
-     checkblock(heap_listp);
-
-     for (bp = heap_listp; get_size(get_header(bp)) > 0; bp = next_block(bp)) {
-         if (verbose)
-             printblock(bp);
-         if (get_size(get_header(next_block(bp))) > 0)
-             checkcoalescing(bp);
-         checkblock(bp);
+     if (quick != arena->quick_bytes) {
+         printf("Error: quick lists hold %zu bytes, not %zu\n", quick, arena->quick_bytes);
+         exit(0);
      }
+     index = 0;
      while (index < NUMBER) {
-         for (bp = int_to_ptr(0U) + index * WSIZE;
-              int_to_ptr((*(unsigned int *) (bp))) != NULL; bp = int_to_ptr((*(unsigned int *) (bp)))) {
-             checkfreelist(bp, index);
+         if ((get_link(list_head(index)) != NULL) != ((arena->free_lists_map >> index) & 1)) {
+             printf("Error: free_lists_map disagrees with list %d\n", index);
+             exit(0);
          }
+         for (bp = list_head(index); get_link(bp) != NULL; bp = get_link(bp))
+             checkfreelist(get_link(bp), index);
          index++;
      }
-     if (verbose)
-         printblock(bp);
-     if ((get_size(get_header(bp)) != 0) || !(get_alloc(get_header(bp)))) {
-         //printf("Bad epilogue header%d \n", (get_size(get_header(bp))));
-     }
 }
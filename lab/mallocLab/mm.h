@@ -21,5 +21,32 @@ extern void *calloc (size_t nmemb, size_t size);
 
 extern bool mm_init(void);
 
+/* Allocate n objects of size bytes into ptrs, return how many were allocated */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+/* Free the n pointers in ptrs, which is sorted in the process */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* size classes reported by mm_stats, at least the number of free lists */
+#define MM_STATS_CLASSES 32
+
+/* Allocator counters since the last mm_init, indexed by size class */
+typedef struct {
+    unsigned long mallocs[MM_STATS_CLASSES];     /* blocks handed out, by their size */
+    unsigned long frees[MM_STATS_CLASSES];       /* blocks taken back, by their size */
+    unsigned long fit_calls;                     /* find_fit searches */
+    unsigned long fit_probes;                    /* free blocks they looked at */
+    unsigned long fit_probes_max;                /* most blocks in one search */
+    unsigned long splits;                        /* blocks split in two */
+    unsigned long coalesces;                     /* free neighbours merged */
+    unsigned long extends;                       /* extend_heap calls */
+    unsigned long extend_bytes;                  /* bytes they added */
+    size_t free_bytes[MM_STATS_CLASSES];         /* free bytes at the call */
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* free blocks at the call */
+    size_t heap_bytes;                           /* size of the brk heap */
+} mm_stats_t;
+
+/* Fill in stats, return false if mm.c was built without MM_STATS */
+extern bool mm_stats(mm_stats_t *stats);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
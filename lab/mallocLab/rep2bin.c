@@ -0,0 +1,101 @@
+/*
+ * rep2bin.c - convert a .rep trace file to the binary format of trace.h
+ *
+ * usage: rep2bin <in.rep> <out>
+ *
+ * mdriver reads either format, telling them apart by the magic at the
+ * start of the file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static void die(const char *msg, const char *filename)
+{
+    fprintf(stderr, "rep2bin: %s %s\n", msg, filename);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    unsigned char header[TRACE_HEADER_SIZE];
+    unsigned char op[TRACE_OP_MAX];
+    char type[1024];
+    int weight, num_ids;
+    long num_ops, op_index = 0;
+    size_t data_bytes, n;
+    unsigned long index, count, size;
+    uint64_t num_reqs = 0, ops_bytes = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <in.rep> <out>\n", argv[0]);
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+        die("could not open", argv[1]);
+    if ((out = fopen(argv[2], "wb")) == NULL)
+        die("could not create", argv[2]);
+    if (fscanf(in, "%d %d %ld %zu", &weight, &num_ids, &num_ops, &data_bytes) != 4)
+        die("bad header in", argv[1]);
+
+    /* the header is written again once the requests are counted */
+    memset(header, 0, sizeof(header));
+    if (fwrite(header, sizeof(header), 1, out) != 1)
+        die("could not write", argv[2]);
+
+    while (op_index < num_ops && fscanf(in, "%1023s", type) == 1) {
+        count = 1;
+        size = 0;
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(in, "%lu %lu", &index, &size) != 2)
+                die("bad request in", argv[1]);
+            break;
+        case 'f':
+            if (fscanf(in, "%lu", &index) != 1)
+                die("bad request in", argv[1]);
+            break;
+        case 'A':
+            if (fscanf(in, "%lu %lu %lu", &index, &count, &size) != 3)
+                die("bad request in", argv[1]);
+            break;
+        case 'F':
+            if (fscanf(in, "%lu %lu", &index, &count) != 2)
+                die("bad request in", argv[1]);
+            break;
+        default:
+            die("bogus request type in", argv[1]);
+        }
+        /* id -1 reads as 0xffffffff, and both become 0 */
+        n = 0;
+        op[n++] = type[0];
+        n += trace_put_varint(op + n, (uint32_t) (index + 1));
+        if (type[0] == 'A' || type[0] == 'F')
+            n += trace_put_varint(op + n, count);
+        if (type[0] != 'f' && type[0] != 'F')
+            n += trace_put_varint(op + n, size);
+        if (fwrite(op, n, 1, out) != 1)
+            die("could not write", argv[2]);
+        ops_bytes += n;
+        num_reqs += count;
+        op_index++;
+    }
+    if (op_index != num_ops)
+        die("too few requests in", argv[1]);
+
+    memcpy(header, TRACE_MAGIC, 8);
+    trace_put_le(header + 8, weight, 4);
+    trace_put_le(header + 12, num_ids, 4);
+    trace_put_le(header + 16, num_ops, 8);
+    trace_put_le(header + 24, num_reqs, 8);
+    trace_put_le(header + 32, data_bytes, 8);
+    trace_put_le(header + 40, ops_bytes, 8);
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(header, sizeof(header), 1, out) != 1 ||
+        fclose(out) != 0)
+        die("could not write", argv[2]);
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * trace.h - binary trace format shared by mdriver and rep2bin
+ *
+ * A binary trace holds the same requests as a .rep file. It starts
+ * with a header of TRACE_HEADER_SIZE bytes:
+ *
+ *   offset  0  magic, the 8 bytes of TRACE_MAGIC
+ *   offset  8  weight, 32 bits
+ *   offset 12  number of block ids, 32 bits
+ *   offset 16  number of requests (lines), 64 bits
+ *   offset 24  number of requests counting each object of a batch, 64 bits
+ *   offset 32  peak bytes allocated, 64 bits
+ *   offset 40  length in bytes of the op array that follows, 64 bits
+ *
+ * Numbers in the header are little-endian. Then come the requests,
+ * packed: a type byte, the .rep letter of the request, followed by
+ * unsigned LEB128 varints. Every request has its block id plus one, so
+ * that id -1 (free of NULL) is 0; 'A' and 'F' then have the object
+ * count; 'a', 'r' and 'A' end with the size in bytes.
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "MMTRACE1"
+#define TRACE_HEADER_SIZE 48
+
+/* The most bytes a varint of 64 bits takes */
+#define TRACE_VARINT_MAX 10
+
+/* The most bytes a request takes: its type and three varints */
+#define TRACE_OP_MAX (1 + 3 * TRACE_VARINT_MAX)
+
+/* Read and write little-endian numbers of the header */
+static inline uint64_t trace_get_le(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static inline void trace_put_le(unsigned char *p, uint64_t v, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++, v >>= 8)
+        p[i] = (unsigned char) v;
+}
+
+/* Write v as a varint at p, return the number of bytes written */
+static inline size_t trace_put_varint(unsigned char *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char) v;
+    return n;
+}
+
+/*
+ * Read a varint from *p, which may not pass end, into *v and move *p
+ * past it. Return 0 if the varint is cut off or too long.
+ */
+static inline int trace_get_varint(const unsigned char **p,
+                                   const unsigned char *end, uint64_t *v)
+{
+    uint64_t x = 0;
+    int shift;
+
+    for (shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char b = *(*p)++;
+        x |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif /* __TRACE_H_ */
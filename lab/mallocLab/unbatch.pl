@@ -0,0 +1,44 @@
+#!/usr/bin/perl
+
+##############################################################################
+#
+# This program rewrites a trace with batch requests as the same trace with
+# single requests: "A <id> <n> <bytes>" becomes n "a" requests and
+# "F <id> <n>" becomes n "f" requests, for ids <id> to <id>+n-1.
+#
+#   unix> ./unbatch.pl traces/syn-nodes-batch.rep > traces/syn-nodes.rep
+#
+##############################################################################
+
+if (@ARGV != 1) {
+    die "Usage: $0 <in.rep>\n";
+}
+open(IN, $ARGV[0]) or die "$0: could not open $ARGV[0]\n";
+
+# The header is weight, number of ids, number of requests, peak bytes
+@header = ();
+while (@header < 4 && ($line = <IN>)) {
+    push(@header, split(' ', $line));
+}
+@header >= 4 or die "$0: bad header in $ARGV[0]\n";
+
+@requests = ();
+while ($line = <IN>) {
+    @f = split(' ', $line);
+    next if (@f == 0);
+    if ($f[0] eq "A") {
+        for ($i = 0; $i < $f[2]; $i++) {
+            push(@requests, "a " . ($f[1] + $i) . " $f[3]");
+        }
+    } elsif ($f[0] eq "F") {
+        for ($i = 0; $i < $f[2]; $i++) {
+            push(@requests, "f " . ($f[1] + $i));
+        }
+    } else {
+        push(@requests, join(" ", @f));
+    }
+}
+close(IN);
+
+print "$header[0]\n$header[1]\n", scalar(@requests), "\n$header[3]\n";
+print "$_\n" foreach (@requests);